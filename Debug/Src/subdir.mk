@@ -6,39 +6,60 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../Src/alarm.c \
+../Src/clock.c \
 ../Src/debug.c \
 ../Src/display.c \
+../Src/event.c \
 ../Src/game.c \
 ../Src/gpio.c \
 ../Src/i2c.c \
+../Src/input.c \
+../Src/log.c \
 ../Src/main.c \
+../Src/profile.c \
+../Src/sched.c \
 ../Src/syscalls.c \
 ../Src/sysmem.c \
-../Src/systick.c 
+../Src/systick.c \
+../Src/timer.c 
 
 OBJS += \
 ./Src/alarm.o \
+./Src/clock.o \
 ./Src/debug.o \
 ./Src/display.o \
+./Src/event.o \
 ./Src/game.o \
 ./Src/gpio.o \
 ./Src/i2c.o \
+./Src/input.o \
+./Src/log.o \
 ./Src/main.o \
+./Src/profile.o \
+./Src/sched.o \
 ./Src/syscalls.o \
 ./Src/sysmem.o \
-./Src/systick.o 
+./Src/systick.o \
+./Src/timer.o 
 
 C_DEPS += \
 ./Src/alarm.d \
+./Src/clock.d \
 ./Src/debug.d \
 ./Src/display.d \
+./Src/event.d \
 ./Src/game.d \
 ./Src/gpio.d \
 ./Src/i2c.d \
+./Src/input.d \
+./Src/log.d \
 ./Src/main.d \
+./Src/profile.d \
+./Src/sched.d \
 ./Src/syscalls.d \
 ./Src/sysmem.d \
-./Src/systick.d 
+./Src/systick.d \
+./Src/timer.d 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -48,7 +69,7 @@ Src/%.o Src/%.su Src/%.cyclo: ../Src/%.c Src/subdir.mk
 clean: clean-Src
 
 clean-Src:
-	-$(RM) ./Src/alarm.cyclo ./Src/alarm.d ./Src/alarm.o ./Src/alarm.su ./Src/debug.cyclo ./Src/debug.d ./Src/debug.o ./Src/debug.su ./Src/display.cyclo ./Src/display.d ./Src/display.o ./Src/display.su ./Src/game.cyclo ./Src/game.d ./Src/game.o ./Src/game.su ./Src/gpio.cyclo ./Src/gpio.d ./Src/gpio.o ./Src/gpio.su ./Src/i2c.cyclo ./Src/i2c.d ./Src/i2c.o ./Src/i2c.su ./Src/main.cyclo ./Src/main.d ./Src/main.o ./Src/main.su ./Src/syscalls.cyclo ./Src/syscalls.d ./Src/syscalls.o ./Src/syscalls.su ./Src/sysmem.cyclo ./Src/sysmem.d ./Src/sysmem.o ./Src/sysmem.su ./Src/systick.cyclo ./Src/systick.d ./Src/systick.o ./Src/systick.su
+	-$(RM) ./Src/alarm.cyclo ./Src/alarm.d ./Src/alarm.o ./Src/alarm.su ./Src/clock.cyclo ./Src/clock.d ./Src/clock.o ./Src/clock.su ./Src/debug.cyclo ./Src/debug.d ./Src/debug.o ./Src/debug.su ./Src/display.cyclo ./Src/display.d ./Src/display.o ./Src/display.su ./Src/event.cyclo ./Src/event.d ./Src/event.o ./Src/event.su ./Src/game.cyclo ./Src/game.d ./Src/game.o ./Src/game.su ./Src/gpio.cyclo ./Src/gpio.d ./Src/gpio.o ./Src/gpio.su ./Src/i2c.cyclo ./Src/i2c.d ./Src/i2c.o ./Src/i2c.su ./Src/input.cyclo ./Src/input.d ./Src/input.o ./Src/input.su ./Src/log.cyclo ./Src/log.d ./Src/log.o ./Src/log.su ./Src/main.cyclo ./Src/main.d ./Src/main.o ./Src/main.su ./Src/profile.cyclo ./Src/profile.d ./Src/profile.o ./Src/profile.su ./Src/sched.cyclo ./Src/sched.d ./Src/sched.o ./Src/sched.su ./Src/syscalls.cyclo ./Src/syscalls.d ./Src/syscalls.o ./Src/syscalls.su ./Src/sysmem.cyclo ./Src/sysmem.d ./Src/sysmem.o ./Src/sysmem.su ./Src/systick.cyclo ./Src/systick.d ./Src/systick.o ./Src/systick.su ./Src/timer.cyclo ./Src/timer.d ./Src/timer.o ./Src/timer.su
 
 .PHONY: clean-Src
 
@@ -0,0 +1,40 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <stdbool.h>
+#include "stm32l5xx.h"
+
+// --------------------------------------------------------
+// System clock profiles
+// --------------------------------------------------------
+// The core comes out of reset on the 4 MHz MSI. The performance profile
+// runs it from the PLL at 110 MHz (MSI / 1 * 55 / 2), which needs
+// voltage range 0 and 5 flash wait states; the low-power profile goes
+// back to the MSI in range 2 with no wait states. SystemCoreClock,
+// SysTick and the I2C bus timing follow every change.
+typedef enum {
+    CLOCK_LOW_POWER,    // MSI 4 MHz
+    CLOCK_PERFORMANCE   // PLL 110 MHz
+} ClockProfile_t;
+
+// Profile selected at startup
+#ifndef CLOCK_PROFILE
+#define CLOCK_PROFILE CLOCK_PERFORMANCE
+#endif
+
+// Tries on each ready flag before a switch is abandoned
+#define CLOCK_TIMEOUT 100000
+
+// --------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------
+
+// Switches to a profile, false if it could not be done: a ready flag
+// timed out (the clock is left on the MSI), or the I2C bus was busy and
+// the clock is unchanged, so try again later
+bool ClockSet(ClockProfile_t profile);
+
+// Returns the profile in use
+ClockProfile_t ClockGet(void);
+
+#endif /* CLOCK_H_ */
@@ -1,6 +1,10 @@
 #ifndef DISPLAY_H_
 #define DISPLAY_H_
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "systick.h"
+
 typedef enum {
     RED     = 0xFF0000,
     GREEN   = 0x00FF00,
@@ -13,9 +17,69 @@ typedef enum {
     OFF     = 0x000000
 } Color_t;
 
+// Marquee step, the time each column stays in view
+#ifndef DISPLAY_SCROLL_MS
+#define DISPLAY_SCROLL_MS 300
+#endif
+
+// Backlight effect steps, and the most writes a second they may take
+#ifndef DISPLAY_LIGHT_STEP_MS
+#define DISPLAY_LIGHT_STEP_MS 20
+#endif
+#ifndef DISPLAY_LIGHT_WRITES
+#define DISPLAY_LIGHT_WRITES 25
+#endif
+
+typedef enum {
+    BLEND_LINEAR,    // Even steps of LED level
+    BLEND_GAMMA      // Even steps of perceived brightness (gamma 2)
+} Blend_t;
+
+typedef enum {
+    METER_BAR,       // Filled from the left up to the value
+    METER_POSITION   // One pixel column at the value
+} Meter_t;
+
 void DisplayEnable(void);
+// Print a line of text, padded with spaces. Formats are a subset of
+// printf: %d %u %x %X %c %s %% with - and 0 flags and a width; the
+// precision of %d and %u places a decimal point (%.1d of 215 is 21.5),
+// at most 10 digits from the right. A NULL %s prints "(null)".
 void DisplayPrint(const int line, const char *msg, ...);
+// Print a line that scrolls if it is longer than the display, showing
+// up to 40 characters (the controller's line memory) in a loop. If the
+// other line is blank or scrolls too, the message is sent once and then
+// scrolled by the controller, else its visible part is rewritten each
+// step; changed text starts over.
+void DisplayMarquee(const int line, const char *msg, ...);
+// Print a score as "<label>a - b"
+void DisplayPrintScore(const int line, const char *label, int a, int b);
 void DisplayColor(Color_t color);
+// Fade the backlight from the color it shows to another over ms
+void DisplayFade(Color_t color, Time_t ms, Blend_t blend);
+// Pulse the backlight from one color to another and back every period
+// ms, until the color is set again; it rests at each color for an
+// eighth of the period
+void DisplayPulse(Color_t color, Color_t other, Time_t period, Blend_t blend);
+// Character code showing a custom 5x8 glyph (8 rows, 5 bits each), put
+// into the LCD's CGRAM as needed. The pattern is known by its address so
+// it must be static. Returns fallback when all 8 slots are on display.
+char DisplayGlyph(const uint8_t pattern[8], char fallback);
+// Draw value / max across a whole line at 5 steps per column
+void DisplayMeter(const int line, unsigned value, unsigned max, Meter_t style);
+// Draw digits of a value on both lines from a column, 4 columns each
+void DisplayBigNumber(int col, unsigned value, int digits);
+// Apps sharing the display, each drawing a frame of its own. The
+// display shows the highest app claiming it, the game if none does.
+typedef enum {DISPLAY_GAME, DISPLAY_ALARM, DISPLAY_APPS} DisplayApp_t;
+// Send the draw and commit calls that follow to an app's frame
+void DisplayDrawFor(DisplayApp_t app);
+// Ask for the display to show an app's frame, or stop asking
+void DisplayClaim(DisplayApp_t app, bool claim);
+// Print, score and color calls draw a frame that only goes to the
+// display when committed by the app showing; the latest commit wins if
+// the previous frame is still being sent
+void DisplayCommit(void);
 void UpdateDisplay(void);
 
 #endif /* DISPLAY_H_ */
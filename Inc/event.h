@@ -0,0 +1,46 @@
+#ifndef EVENT_H_
+#define EVENT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "systick.h"
+
+// --------------------------------------------------------
+// Event queues
+// --------------------------------------------------------
+// A lock-free ring of timestamped events from interrupt handlers to a
+// task. There must be one producer and one consumer: either a single
+// handler, or handlers of one priority so that none interrupts another
+// mid-push. Each index is only written by its own side, and counts up
+// freely; the slot is the index modulo the power-of-two size.
+
+#define EVENT_QUEUE_SIZE 16  // Must be a power of two
+
+typedef struct {
+    Time_t  time;  // TimeNow() when pushed
+    uint8_t type;  // Up to the app
+    uint8_t arg;
+} Event_t;
+
+typedef struct {
+    Event_t ring[EVENT_QUEUE_SIZE];
+    volatile uint32_t head;       // Next slot to fill, producer only
+    volatile uint32_t tail;       // Next slot to drain, consumer only
+    volatile uint32_t overflows;  // Events dropped on a full queue
+} EventQueue_t;
+
+// Static initializer for an empty queue
+#define EVENT_QUEUE {{{0, 0, 0}}, 0, 0, 0}
+
+// --------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------
+
+// Adds an event stamped with the current time, false if the queue is
+// full and the event was counted as an overflow (producer side)
+bool EventPush(EventQueue_t *q, uint8_t type, uint8_t arg);
+
+// Takes the oldest event, false if there is none (consumer side)
+bool EventPop(EventQueue_t *q, Event_t *e);
+
+#endif /* EVENT_H_ */
@@ -36,8 +36,26 @@ void GPIO_Callback(Pin_t pin, void (*func)(void), PinEdge_t edge);
 extern GPIO_TypeDef IOX_GPIO_Regs;
 #define GPIOX (&IOX_GPIO_Regs)
 
+// Read the button expander when its INT output signals a change (1),
+// or poll it every tick (0). INT is open-drain, active low, on PF3.
+#ifndef IOX_INTERRUPTS
+#define IOX_INTERRUPTS 1
+#endif
+#define IOX_POLL_MS 100  // Fallback button poll with IOX_INTERRUPTS
+#define IOX_STUCK_READS 3  // Reads on INT low finding nothing, then poll
+
+// LED expander writes, and the writes saved against the old update
+// that rewrote the LEDs on every 1 ms tick: each millisecond passed
+// without a write counts as one
+typedef struct {
+    uint32_t ledWrites;
+    uint32_t ledElided;
+} IOX_Stats_t;
+extern IOX_Stats_t IOX_Stats;
+
 void GPIO_PortEnable(GPIO_TypeDef *port);
 uint16_t GPIO_PortInput(GPIO_TypeDef *port);
 void GPIO_PortOutput(GPIO_TypeDef *port, uint16_t value);
+void UpdateIOExpanders(void);  // Called from main loop
 
 #endif /* GPIO_H_ */
@@ -5,30 +5,93 @@
 #include "stm32l5xx.h"
 #include "gpio.h"
 
+// Drain the transfer queue from the I2C event/error interrupts (1)
+// or by polling ServiceI2CRequests() from the main loop (0)
+#ifndef I2C_INTERRUPTS
+#define I2C_INTERRUPTS 1
+#endif
+
+// Transfers of at least this many bytes are moved by DMA on buses that
+// support it (I2C2 on DMA1 channels 1/2); shorter ones are cheaper to
+// copy from the interrupt handler. Requires I2C_INTERRUPTS.
+#define I2C_DMA_MIN 4
+
+// SCL frequencies of the bus modes (Hz)
+#define I2C_STANDARD  100000   // Standard-mode
+#define I2C_FAST      400000   // Fast-mode
+#define I2C_FAST_PLUS 1000000  // Fast-mode Plus
+
 // I2C bus connection
 typedef struct {
     I2C_TypeDef *iface;   // Interface registers I2C1-I2C4
     Pin_t        pinSDA;  // MCU pin for SDA
     Pin_t        pinSCL;  // MCU pin for SCL
+    int          dmaMin;  // Smallest transfer handed to DMA, 0 = CPU only
+    uint32_t     speed;   // Requested SCL frequency
+    uint32_t     limit;   // Slowest target declared on it, 0 = none yet
 } I2C_Bus_t;
 
 extern I2C_Bus_t LeafyI2C;   // I2C bus on Leafy mainboard
 
+// Priority classes, each with its own FIFO. Whenever the bus becomes
+// free the oldest high priority transfer goes first, so input reads
+// wait for at most one display transfer rather than the whole queue.
+typedef enum {I2C_LOW = 0, I2C_HIGH = 1} I2C_Prio_t;
+#define I2C_PRIOS 2
+
+// Further segment of a compound transfer. A segment in the same
+// direction as the one before it continues the same message (RELOAD),
+// so a buffer can be sent straight after a register address; a change
+// of direction turns the bus around with a repeated START, as in a
+// register read (write the address, then read the value).
+typedef struct {
+    uint8_t *data;           // Data buffer
+    int      size;           // Number of bytes, at least 1
+    bool     read;           // Read from the target, else write to it
+} I2C_Seg_t;
+
 // I2C transfer record
 typedef struct I2C_Xfer_t {
     I2C_Bus_t *bus;          // Pointer to I2C bus structure
     uint8_t    addr;         // 7-bit target address and read/write bit
     uint8_t   *data;         // Pointer to data buffer
-    int        size;         // Total number of bytes in transfer
+    int        size;         // Number of bytes in the first segment
 
-    bool       stop;         // Whether or not to issue a STOP condition
-    bool       busy;         // Busy indicator (queued or in progress)
+    bool       stop;         // Whether or not to issue a STOP at the end
+    volatile bool busy;      // Busy indicator (queued or in progress)
 
     struct I2C_Xfer_t *next; // Pointer to next transfer in queue
+    I2C_Prio_t prio;         // Queue class, I2C_LOW if not given
+    const I2C_Seg_t *more;   // Segments after the first, NULL if none
+    int        moreSegs;     // Number of them
+    uint32_t   queued;       // TimeNowUs() when requested
 } I2C_Xfer_t;
 
+// Time transfers of one class spent queued before their START
+typedef struct {
+    uint32_t count;          // Transfers started
+    uint32_t maxWaitUs;      // Longest wait
+    uint64_t waitUs;         // Sum of waits
+} I2C_WaitStats_t;
+
 void I2C_Enable(I2C_Bus_t bus);      // Enable I2C bus connection
-void I2C_Request(I2C_Xfer_t *p);     // Request a new transfer
+void I2C_Retime(I2C_Bus_t bus);      // Apply speed and clock once idle
+
+// Declare a target and the fastest SCL it supports; the bus runs no
+// faster than its slowest target
+void I2C_Device(I2C_Bus_t *bus, uint8_t addr, uint32_t maxSpeed);
+
+// TIMINGR for an I2C kernel clock and SCL frequency, from the bus-mode
+// timing limits. The resulting SCL is as close as possible without
+// exceeding the request, 0 if no setting meets the limits.
+uint32_t I2C_Timing(uint32_t clockHz, uint32_t sclHz);
+
+// Request a new transfer. A transfer may be requested again while it is
+// on the bus, and goes out once more afterwards; one still waiting in
+// the queue is left in its place and sends its buffer as it is then.
+void I2C_Request(I2C_Xfer_t *p);
 void ServiceI2CRequests(void);       // Called from main loop
+I2C_WaitStats_t I2C_WaitStats(I2C_Prio_t c);  // Copy, safe from the ISR
+bool I2C_Idle(void);                 // Nothing queued or on the bus
 
 #endif /* I2C_H_ */
@@ -0,0 +1,42 @@
+#ifndef INPUT_H_
+#define INPUT_H_
+
+#include <stdint.h>
+#include "systick.h"
+
+// --------------------------------------------------------
+// Debounced GPIOX buttons
+// --------------------------------------------------------
+// GPIO_PortInput(GPIOX) is sampled every INPUT_SAMPLE_MS while any bit
+// differs from its debounced state. A bit changes state after 4 samples
+// in a row agree, counted for all 16 bits at once by a 2-bit vertical
+// counter. Apps read press, release and long-press events instead of
+// comparing levels with the previous pass.
+
+#define INPUT_SAMPLE_MS 5  // Debounce sample interval, 4 samples to change
+
+typedef struct {
+    uint16_t pressed;   // Bits that went down (1 = pressed on GPIOX)
+    uint16_t released;  // Bits that went up
+    uint16_t held;      // Bits down for their long-press time, once per press
+    uint16_t state;     // Debounced levels
+    Time_t   time;      // When the latest of these events was detected
+} InputEvents_t;
+
+// --------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------
+
+// Samples and debounces the inputs, called from main loop
+void InputUpdate(void);
+
+// Returns the events since the last call and clears them
+InputEvents_t InputRead(void);
+
+// Reports the bits in mask as held after ms of being down, 0 = never
+void InputLongPress(uint16_t mask, Time_t ms);
+
+// Names the scheduler task to signal when new events arrive
+void InputNotify(void (*task)(void));
+
+#endif /* INPUT_H_ */
@@ -0,0 +1,50 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <stdint.h>
+
+// --------------------------------------------------------
+// Deferred binary logging
+// --------------------------------------------------------
+// LOG() does no formatting on the target. It stores the address of its
+// format string and the raw 32-bit arguments in a RAM ring, and
+// LogDrain() sends them out over ITM stimulus port LOG_PORT when the
+// main loop is about to sleep. The format strings live in the "logstr"
+// section, which the linker script keeps out of flash; the host reads
+// them back from the .elf (Tools/logdecode.py).
+//
+// A record is a header word, the string address with the argument
+// count in its two low bits, followed by the arguments. Only integer
+// conversions can be used (%d %u %x %c, with flags and width).
+
+#define LOG_PORT       1    // ITM stimulus port, 0 carries printf text
+#define LOG_RING_WORDS 256  // Must be a power of two
+#define LOG_MAX_ARGS   3
+
+// Logs a message with up to LOG_MAX_ARGS integer arguments, from any
+// context. A record that does not fit in the ring is dropped and counted.
+#define LOG(fmt, ...) do {                                                  \
+    static const char logFmt[]                                              \
+        __attribute__((section("logstr"), aligned(4))) = fmt;               \
+    const uint32_t logArgs[] = {0, ##__VA_ARGS__};                          \
+    _Static_assert(sizeof logArgs <= (LOG_MAX_ARGS + 1) * sizeof(uint32_t), \
+                   "too many LOG() arguments");                             \
+    LogWrite((uint32_t)(uintptr_t)logFmt |                                  \
+             (sizeof logArgs / sizeof logArgs[0] - 1), logArgs + 1);        \
+} while (0)
+
+// --------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------
+
+// Adds a record to the ring, use LOG() instead
+void LogWrite(uint32_t header, const uint32_t *args);
+
+// Sends what the ITM FIFO takes, then asks for a wake-up to send the
+// rest; empties the ring when no trace probe has enabled the port
+void LogDrain(void);
+
+// Records dropped on a full ring so far
+uint32_t LogDropped(void);
+
+#endif /* LOG_H_ */
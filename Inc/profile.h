@@ -0,0 +1,81 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+// --------------------------------------------------------
+// Main loop profiler (DWT cycle counter)
+// --------------------------------------------------------
+// Built into debug configurations only (-DDEBUG). In release builds
+// every PROFILE_* macro expands to nothing and no code or RAM is used.
+#ifndef PROFILE
+#ifdef DEBUG
+#define PROFILE 1
+#else
+#define PROFILE 0
+#endif
+#endif
+
+// Sections measured in the main loop
+typedef enum {
+    PROF_ALARM,     // Task_Alarm()
+    PROF_GAME,      // Task_Game()
+    PROF_IOX,       // UpdateIOExpanders()
+    PROF_INPUT,     // InputUpdate()
+    PROF_DISPLAY,   // UpdateDisplay()
+    PROF_I2C,       // ServiceI2CRequests()
+    PROF_LOOP,      // Whole loop pass, excluding the wait for the tick
+                    // and the report
+    PROF_REPORT,    // Printing these statistics
+    PROF_NUM
+} ProfId_t;
+
+#define PROF_REPORT_MS 5000 // Dump and restart statistics this often
+
+// Histogram with four buckets per power of two (about 19% resolution),
+// samples of 2^22 cycles or more land in the last bucket
+#define PROF_BUCKETS 84
+
+typedef struct {
+    uint32_t n;                     // Number of samples
+    uint32_t min, max;              // Cycles
+    uint64_t sum;
+    uint16_t hist[PROF_BUCKETS];    // Saturating counts
+} ProfStat_t;
+
+#if PROFILE
+// --------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------
+
+// Enables the DWT cycle counter and clears all statistics
+void ProfileInit(void);
+
+// Clears all statistics
+void ProfileReset(void);
+
+// Returns the current cycle count, start of a measured section
+uint32_t ProfileStamp(void);
+
+// Records the cycles since 'since' against a section, returns the new stamp
+uint32_t ProfileLap(ProfId_t id, uint32_t since);
+
+// Statistics collected for a section
+const ProfStat_t *ProfileStat(ProfId_t id);
+
+// Upper bound on the cycles taken by pct percent of the samples
+uint32_t ProfilePercentile(ProfId_t id, unsigned pct);
+
+// Prints a table of all sections over ITM
+void ProfileDump(void);
+
+#define PROFILE_INIT()          ProfileInit()
+#define PROFILE_START(t)        uint32_t t = ProfileStamp()
+#define PROFILE_LAP(id, t)      ((t) = ProfileLap((id), (t)))
+#else
+#define PROFILE_INIT()
+#define PROFILE_START(t)
+#define PROFILE_LAP(id, t)
+#endif
+
+#endif /* PROFILE_H_ */
@@ -0,0 +1,59 @@
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "systick.h"
+
+// --------------------------------------------------------
+// Cooperative scheduler
+// --------------------------------------------------------
+// Tasks are listed in a static table and run to completion from the
+// main loop. On each pass SchedRun() runs, in priority order, the tasks
+// whose period has elapsed and those signalled with SchedSignal() since
+// they last ran; the rest are skipped. Tasks that must look at their
+// inputs on every pass (the I/O housekeeping) use SCHED_EVERY_PASS.
+
+#define SCHED_EVERY_PASS 0         // Period: run on every pass
+#define SCHED_ON_SIGNAL  TIME_MAX  // Period: run only when signalled
+
+typedef struct {
+    const char *name;
+    void (*init)(void);       // Called once by SchedStart(), may be NULL
+    void (*run)(void);        // Called when due or signalled
+    Time_t  period;           // ms between runs, or one of the above
+    uint8_t priority;         // 0 runs first within a pass
+    uint8_t prof;             // ProfId_t section when profiling
+
+    // Bookkeeping
+    Time_t   deadline;        // When the next periodic run is due
+    volatile bool signalled;  // Events arrived since the last run
+    uint32_t runs;
+    uint32_t late;            // Periodic runs that started after a whole period
+    Time_t   maxLate;         // Worst start delay past the deadline (ms)
+    uint64_t busyUs;          // Time spent running
+    uint32_t maxUs;           // Longest single run
+} Task_t;
+
+// Static initializer for a task table entry
+#define TASK(name, init, run, period, priority, prof) \
+    {(name), (init), (run), (period), (priority), (prof), 0, false, 0, 0, 0, 0, 0}
+
+// --------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------
+
+// Sorts the table by priority and calls each task's init function
+void SchedStart(Task_t *table, int count);
+
+// Runs the due and signalled tasks once, called from main loop
+void SchedRun(void);
+
+// Marks the task with this run function as having work and wakes the
+// main loop (interrupt safe)
+void SchedSignal(void (*run)(void));
+
+// Prints run counts and times of all tasks over ITM
+void SchedDump(void);
+
+#endif /* SCHED_H_ */
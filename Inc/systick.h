@@ -1,6 +1,7 @@
 #ifndef SYSTICK_H_
 #define SYSTICK_H_
 
+#include <stdint.h>
 #include "stm32l5xx.h"
 
 // --------------------------------------------------------
@@ -9,6 +10,16 @@
 typedef unsigned int Time_t;
 #define TIME_MAX ((Time_t)-1)
 
+// Let SysTick run until the next deadline instead of waking every 1 ms
+// (1), or keep the fixed 1 ms tick (0)
+#ifndef TICKLESS_IDLE
+#define TICKLESS_IDLE 1
+#endif
+
+// Longest tickless sleep; shorter at high clock rates, where the 24-bit
+// SysTick counter covers less time
+#define MAX_SLEEP 4000
+
 // --------------------------------------------------------
 // Function prototypes
 // --------------------------------------------------------
@@ -16,15 +27,33 @@ typedef unsigned int Time_t;
 // Initializes the SysTick timer (1 ms tick)
 void StartSysTick(void);
 
+// Rescales the tick after SystemCoreClock has changed, keeping the time
+void RetuneSysTick(void);
+
 // Waits for the next SysTick interrupt (used for timing control)
 void WaitForSysTick(void);
 
+// Sleeps until the earliest WakeAt() time requested since the last call,
+// or until an interrupt handler calls WakeNow(); main loop idle point
+void WaitForEvent(void);
+
+// Requests the next main loop pass no later than time t (interrupt safe)
+void WakeAt(Time_t t);
+
+// Requests a main loop pass as soon as possible (interrupt safe)
+void WakeNow(void);
+
 // Blocks for t milliseconds (busy wait)
 void msDelay(int t);
 
 // Returns the current system time in milliseconds
 Time_t TimeNow(void);
 
+// Returns milliseconds/microseconds since StartSysTick() as 64-bit
+// counts that never wrap; safe from interrupt handlers
+uint64_t TimeNow64(void);
+uint64_t TimeNowUs(void);
+
 // Returns time elapsed since a given timestamp
 Time_t TimePassed(Time_t since);
 
@@ -0,0 +1,56 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "systick.h"
+
+// --------------------------------------------------------
+// Software timers
+// --------------------------------------------------------
+// Timers live in a hierarchical wheel (3 levels of 64 slots at 1 ms,
+// 64 ms and 4096 ms resolution), so starting, stopping and expiring
+// one takes constant time however many are running. TimerService()
+// expires them from the main loop, and asks to be woken at the next
+// expiry so that tickless idle sleeps in between.
+
+typedef struct Timer_t {
+    Time_t expires;                     // Time of next expiry
+    Time_t period;                      // Reload interval, 0 = one-shot
+    void (*callback)(struct Timer_t *); // Called on expiry, may be NULL
+
+    bool active;                        // Running
+    volatile bool fired;                // Expired since last TimerFired()
+
+    struct Timer_t *next;               // Wheel slot list
+    struct Timer_t **pprev;
+    uint8_t level, slot;
+} Timer_t;
+
+// Static initializer for a timer with an optional callback
+#define TIMER(cb) {0, 0, (cb), false, false, NULL, NULL, 0, 0}
+
+// --------------------------------------------------------
+// Function prototypes
+// --------------------------------------------------------
+
+// (Re)starts a timer expiring 'delay' ms from now, then every 'period'
+// ms if non-zero; clears any pending expiry (interrupt safe)
+void TimerStart(Timer_t *t, Time_t delay, Time_t period);
+
+// Stops a timer, a pending expiry stays until TimerFired() (interrupt safe)
+void TimerStop(Timer_t *t);
+
+// Returns true once for each expiry (event-style delivery)
+bool TimerFired(Timer_t *t);
+
+// Whether a timer is running
+bool TimerActive(const Timer_t *t);
+
+// Expires due timers and runs their callbacks, called from main loop
+void TimerService(void);
+
+// Earliest time the wheel has work, TimeNow() + MAX_SLEEP if idle
+Time_t TimerNextExpiry(void);
+
+#endif /* TIMER_H_ */
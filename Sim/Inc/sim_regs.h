@@ -0,0 +1,142 @@
+#ifndef SIM_REGS_H_
+#define SIM_REGS_H_
+
+// --------------------------------------------------------
+// Board simulator register map
+// --------------------------------------------------------
+// The firmware is compiled for the host with every peripheral base
+// redirected to a register block in host memory. The simulator
+// (Sim/sim.c) observes these blocks whenever the firmware sleeps
+// and plays the role of the hardware.
+
+#include <stdint.h>
+
+// GPIO ports keep their 0x400 stride so that GPIO_PORT_NUM() works
+extern uint8_t Sim_GPIOMem[8][0x400];
+
+extern RCC_TypeDef            Sim_RCC;
+RCC_TypeDef *SimRCC(void);  // Ready flags follow enables
+extern PWR_TypeDef            Sim_PWR;
+extern FLASH_TypeDef          Sim_FLASH;
+extern EXTI_TypeDef           Sim_EXTI;
+extern SYSCFG_TypeDef         Sim_SYSCFG;
+extern I2C_TypeDef            Sim_I2C[4];
+extern DMA_TypeDef            Sim_DMA1;
+extern DMA_Channel_TypeDef    Sim_DMA1_Channel[8];
+extern DMAMUX_Channel_TypeDef Sim_DMAMUX1_Channel[8];
+extern SysTick_Type           Sim_SysTick;
+SysTick_Type *SimSysTick(void);  // Live VAL, VAL-write detection
+extern NVIC_Type              Sim_NVIC;
+NVIC_Type *SimNVIC(void);  // Write-1-to-set/clear emulation
+extern SCB_Type               Sim_SCB;
+extern ITM_Type               Sim_ITM;
+extern DWT_Type               Sim_DWT;
+extern CoreDebug_Type         Sim_CoreDebug;
+
+#undef GPIOA
+#undef GPIOB
+#undef GPIOC
+#undef GPIOD
+#undef GPIOE
+#undef GPIOF
+#undef GPIOG
+#undef GPIOH
+#define GPIOA ((GPIO_TypeDef *)Sim_GPIOMem[0])
+#define GPIOB ((GPIO_TypeDef *)Sim_GPIOMem[1])
+#define GPIOC ((GPIO_TypeDef *)Sim_GPIOMem[2])
+#define GPIOD ((GPIO_TypeDef *)Sim_GPIOMem[3])
+#define GPIOE ((GPIO_TypeDef *)Sim_GPIOMem[4])
+#define GPIOF ((GPIO_TypeDef *)Sim_GPIOMem[5])
+#define GPIOG ((GPIO_TypeDef *)Sim_GPIOMem[6])
+#define GPIOH ((GPIO_TypeDef *)Sim_GPIOMem[7])
+
+#undef RCC
+#undef PWR
+#undef FLASH
+#undef EXTI
+#undef SYSCFG
+#define RCC    (SimRCC())
+#define PWR    (&Sim_PWR)
+#define FLASH  (&Sim_FLASH)
+#define EXTI   (&Sim_EXTI)
+#define SYSCFG (&Sim_SYSCFG)
+
+#undef I2C1
+#undef I2C2
+#undef I2C3
+#undef I2C4
+#define I2C1 (&Sim_I2C[0])
+#define I2C2 (&Sim_I2C[1])
+#define I2C3 (&Sim_I2C[2])
+#define I2C4 (&Sim_I2C[3])
+
+#undef DMA1
+#undef DMA1_Channel1
+#undef DMA1_Channel2
+#undef DMA1_Channel3
+#undef DMA1_Channel4
+#undef DMA1_Channel5
+#undef DMA1_Channel6
+#undef DMA1_Channel7
+#undef DMA1_Channel8
+#define DMA1          (&Sim_DMA1)
+#define DMA1_Channel1 (&Sim_DMA1_Channel[0])
+#define DMA1_Channel2 (&Sim_DMA1_Channel[1])
+#define DMA1_Channel3 (&Sim_DMA1_Channel[2])
+#define DMA1_Channel4 (&Sim_DMA1_Channel[3])
+#define DMA1_Channel5 (&Sim_DMA1_Channel[4])
+#define DMA1_Channel6 (&Sim_DMA1_Channel[5])
+#define DMA1_Channel7 (&Sim_DMA1_Channel[6])
+#define DMA1_Channel8 (&Sim_DMA1_Channel[7])
+
+#undef DMAMUX1_Channel0
+#undef DMAMUX1_Channel1
+#undef DMAMUX1_Channel2
+#undef DMAMUX1_Channel3
+#undef DMAMUX1_Channel4
+#undef DMAMUX1_Channel5
+#undef DMAMUX1_Channel6
+#undef DMAMUX1_Channel7
+#define DMAMUX1_Channel0 (&Sim_DMAMUX1_Channel[0])
+#define DMAMUX1_Channel1 (&Sim_DMAMUX1_Channel[1])
+#define DMAMUX1_Channel2 (&Sim_DMAMUX1_Channel[2])
+#define DMAMUX1_Channel3 (&Sim_DMAMUX1_Channel[3])
+#define DMAMUX1_Channel4 (&Sim_DMAMUX1_Channel[4])
+#define DMAMUX1_Channel5 (&Sim_DMAMUX1_Channel[5])
+#define DMAMUX1_Channel6 (&Sim_DMAMUX1_Channel[6])
+#define DMAMUX1_Channel7 (&Sim_DMAMUX1_Channel[7])
+
+#undef SysTick
+#undef NVIC
+#undef SCB
+#undef ITM
+#undef DWT
+#undef CoreDebug
+#define SysTick   (SimSysTick())
+#define NVIC      (SimNVIC())
+#define SCB       (&Sim_SCB)
+#define ITM       (&Sim_ITM)
+#define DWT       (&Sim_DWT)
+#define CoreDebug (&Sim_CoreDebug)
+
+// --------------------------------------------------------
+// Core intrinsics
+// --------------------------------------------------------
+// Interrupts are only taken while the firmware sleeps, so the sleep
+// instruction is where simulated time advances.
+void     SimWFI(void);
+uint32_t SimGetPrimask(void);
+void     SimSetPrimask(uint32_t primask);
+
+#undef __WFI
+#define __WFI()           SimWFI()
+#define __disable_irq()   SimSetPrimask(1)
+#define __enable_irq()    SimSetPrimask(0)
+#define __get_PRIMASK()   SimGetPrimask()
+#define __set_PRIMASK(x)  SimSetPrimask(x)
+
+// Log words leave through the trace probe rather than a register block
+void     SimITMSend32(uint32_t port, uint32_t w);
+#define ITM_Send32(port, w) SimITMSend32(port, w)
+
+#endif /* SIM_REGS_H_ */
@@ -0,0 +1,3 @@
+// Simulator wrapper: device header with peripherals mapped to host memory
+#include_next "stm32l552xx.h"
+#include "sim_regs.h"
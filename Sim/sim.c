@@ -0,0 +1,1019 @@
+// Board simulator: register-level models of the MCU peripherals used by
+// the firmware, and behavioral models of the devices on the Leafy I2C bus
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "sim.h"
+#include "log.h"  // Record format on the log port
+
+#define MSI_HZ  4000000  // MSI default clock
+#define MS      (SIM_HZ / 1000)
+
+SimStats_t SimStats;
+bool SimVerbose = false;
+
+// --------------------------------------------------------
+// Peripheral register blocks
+// --------------------------------------------------------
+uint8_t Sim_GPIOMem[8][0x400] __attribute__((aligned(0x10000)));
+
+RCC_TypeDef            Sim_RCC;
+PWR_TypeDef            Sim_PWR;
+FLASH_TypeDef          Sim_FLASH;
+EXTI_TypeDef           Sim_EXTI;
+SYSCFG_TypeDef         Sim_SYSCFG;
+I2C_TypeDef            Sim_I2C[4];
+DMA_TypeDef            Sim_DMA1;
+DMA_Channel_TypeDef    Sim_DMA1_Channel[8];
+DMAMUX_Channel_TypeDef Sim_DMAMUX1_Channel[8];
+SysTick_Type           Sim_SysTick;
+NVIC_Type              Sim_NVIC;
+SCB_Type               Sim_SCB;
+ITM_Type               Sim_ITM;
+DWT_Type               Sim_DWT;
+CoreDebug_Type         Sim_CoreDebug;
+
+// Firmware interrupt handlers
+void SysTick_Handler(void);
+void EXTI0_IRQHandler(void);
+void EXTI1_IRQHandler(void);
+void EXTI2_IRQHandler(void);
+void EXTI3_IRQHandler(void);
+void EXTI4_IRQHandler(void);
+void EXTI5_IRQHandler(void);
+void EXTI6_IRQHandler(void);
+void EXTI7_IRQHandler(void);
+void EXTI8_IRQHandler(void);
+void EXTI9_IRQHandler(void);
+void EXTI10_IRQHandler(void);
+void EXTI11_IRQHandler(void);
+void EXTI12_IRQHandler(void);
+void EXTI13_IRQHandler(void);
+void EXTI14_IRQHandler(void);
+void EXTI15_IRQHandler(void);
+void I2C2_EV_IRQHandler(void);
+void I2C2_ER_IRQHandler(void);
+
+static void (*const extiHandler[16])(void) = {
+    EXTI0_IRQHandler,  EXTI1_IRQHandler,  EXTI2_IRQHandler,  EXTI3_IRQHandler,
+    EXTI4_IRQHandler,  EXTI5_IRQHandler,  EXTI6_IRQHandler,  EXTI7_IRQHandler,
+    EXTI8_IRQHandler,  EXTI9_IRQHandler,  EXTI10_IRQHandler, EXTI11_IRQHandler,
+    EXTI12_IRQHandler, EXTI13_IRQHandler, EXTI14_IRQHandler, EXTI15_IRQHandler
+};
+
+// --------------------------------------------------------
+// Simulated time and interrupt masking
+// --------------------------------------------------------
+static uint64_t now = 0;       // Time since reset, 1 / SIM_HZ units
+static uint32_t coreHz = MSI_HZ;
+static uint64_t cycle = SIM_HZ / MSI_HZ;  // Time units per core clock
+static uint64_t endTime = 0;   // Stop the run at this time
+static jmp_buf simExit;
+static uint32_t primask = 0;
+static int handlerDepth = 0;   // Nesting of interrupt handlers
+static uint64_t sleeps = 0;    // WFI instructions executed
+
+static bool Dispatch(void);
+
+uint32_t SimGetPrimask(void) {
+    return primask;
+}
+
+// Unmasking from thread mode takes pending interrupts right away
+void SimSetPrimask(uint32_t mask) {
+    bool unmask = primask && !(mask & 1);
+    primask = mask & 1;
+    if (unmask && handlerDepth == 0)
+        Dispatch();
+}
+
+static double Millis(uint64_t t) {
+    return (double)t / MS;
+}
+
+// NVIC enable registers are write-1-to-set/clear: fold each write into
+// the enabled state whenever the firmware touches the NVIC again
+static uint32_t nvicEnabled[16];
+
+NVIC_Type *SimNVIC(void) {
+    for (int i = 0; i < 16; i++) {
+        nvicEnabled[i] = (nvicEnabled[i] | Sim_NVIC.ISER[i]) & ~Sim_NVIC.ICER[i];
+        Sim_NVIC.ISER[i] = nvicEnabled[i];
+        Sim_NVIC.ICER[i] = 0;
+    }
+    return &Sim_NVIC;
+}
+
+static bool IrqEnabled(int irq) {
+    return SimNVIC()->ISER[irq / 32] & (1u << (irq % 32));
+}
+
+// --------------------------------------------------------
+// Input/output tracking for latency measurements
+// --------------------------------------------------------
+static uint64_t inputAt = 0;      // Time of last unanswered input change
+static bool inputPending = false;
+
+static void InputChanged(void) {
+    inputAt = now;
+    inputPending = true;
+}
+
+static void OutputChanged(void) {
+    if (!inputPending)
+        return;
+    uint64_t lat = now - inputAt;
+    if (SimStats.latencyN == 0 || lat < SimStats.latencyMin)
+        SimStats.latencyMin = lat;
+    if (lat > SimStats.latencyMax)
+        SimStats.latencyMax = lat;
+    SimStats.latencySum += lat;
+    SimStats.latencyN++;
+    inputPending = false;
+}
+
+// --------------------------------------------------------
+// I2C devices
+// --------------------------------------------------------
+typedef struct {
+    uint8_t     addr;   // 8-bit write address
+    const char *name;
+    void      (*start)(bool read);
+    void      (*write)(uint8_t data);
+    uint8_t   (*read)(void);
+    void      (*stop)(void);
+    uint64_t    bytes;
+    uint64_t    xfers;
+} Device_t;
+
+// LCD controller (HD44780 command set behind an I2C control byte)
+static struct {
+    uint8_t ddram[2][40];   // Display data, 40 columns per line
+    uint8_t cgram[64];      // Custom character patterns
+    int     ac;             // Address counter (0x00-0x27, 0x40-0x67)
+    bool    cg;             // Address counter points into CGRAM
+    int     shift;          // Display shift in columns
+    bool    on;
+    bool    rs;             // Register select from last control byte
+    enum {LCD_CTRL, LCD_ONE, LCD_STREAM} st;
+    char    shown[2][17];   // Visible text at the last STOP
+    uint8_t cgShown[64];    // CGRAM at the last STOP
+} lcd;
+
+static void LcdClear(void) {
+    memset(lcd.ddram, ' ', sizeof lcd.ddram);
+    lcd.ac = 0;
+    lcd.cg = false;
+    lcd.shift = 0;
+}
+
+static void LcdExec(uint8_t b) {
+    if (lcd.rs) {
+        // Data write at the address counter
+        if (lcd.cg) {
+            lcd.cgram[lcd.ac & 0x3F] = b;
+            lcd.ac = (lcd.ac + 1) & 0x3F;
+        } else {
+            int line = lcd.ac >= 0x40, col = lcd.ac & 0x3F;
+            if (col < 40)
+                lcd.ddram[line][col] = b;
+            lcd.ac = col + 1 < 40 ? lcd.ac + 1 : (line ? 0x00 : 0x40);
+        }
+    }
+    else if (b & 0x80) { lcd.ac = b & 0x7F; lcd.cg = false; }  // Set DDRAM
+    else if (b & 0x40) { lcd.ac = b & 0x3F; lcd.cg = true; }   // Set CGRAM
+    else if (b & 0x20) { }                                     // Function set
+    else if (b & 0x10) {                                       // Shift
+        if (b & 0x08)
+            lcd.shift = (lcd.shift + ((b & 0x04) ? 39 : 1)) % 40;
+    }
+    else if (b & 0x08) lcd.on = b & 0x04;                      // Display ctrl
+    else if (b & 0x04) { }                                     // Entry mode
+    else if (b & 0x02) { lcd.ac = 0; lcd.shift = 0; }          // Home
+    else if (b & 0x01) LcdClear();                             // Clear
+}
+
+static void LcdStart(bool read) {
+    (void)read;
+    lcd.st = LCD_CTRL;
+}
+
+static void LcdWrite(uint8_t b) {
+    switch (lcd.st) {
+    case LCD_CTRL:
+        lcd.rs = b & 0x40;
+        lcd.st = (b & 0x80) ? LCD_ONE : LCD_STREAM;  // Co bit
+        break;
+    case LCD_ONE:
+        LcdExec(b);
+        lcd.st = LCD_CTRL;
+        break;
+    case LCD_STREAM:
+        LcdExec(b);
+        break;
+    }
+}
+
+static uint8_t LcdRead(void) {
+    return 0;
+}
+
+// Visible character at a display position: custom glyphs show as '+'
+// and the ROM's full block as '#'
+static char LcdChar(int line, int col) {
+    uint8_t c = lcd.ddram[line][(col + lcd.shift) % 40];
+    return c < 0x10 ? '+' : c == 0xFF ? '#' : (c >= 0x20 && c < 0x7F) ? c : '?';
+}
+
+static void LcdStop(void) {
+    for (int g = 0; g < 8; g++) {
+        if (memcmp(&lcd.cgram[g * 8], &lcd.cgShown[g * 8], 8) == 0)
+            continue;
+        memcpy(&lcd.cgShown[g * 8], &lcd.cgram[g * 8], 8);
+        if (SimVerbose) {
+            printf("%10.3f ms  CGRAM%d", Millis(now), g);
+            for (int r = 0; r < 8; r++)
+                printf(" %02X", lcd.cgram[g * 8 + r]);
+            printf("\n");
+        }
+    }
+    for (int line = 0; line < 2; line++) {
+        char text[17];
+        for (int col = 0; col < 16; col++)
+            text[col] = LcdChar(line, col);
+        text[16] = 0;
+        if (strcmp(text, lcd.shown[line]) != 0) {
+            strcpy(lcd.shown[line], text);
+            if (SimVerbose)
+                printf("%10.3f ms  LCD%d |%s|\n", Millis(now), line + 1, text);
+        }
+    }
+}
+
+const char *SimLcdLine(int line) {
+    return lcd.shown[line];
+}
+
+const char *SimLcdMemory(int line) {
+    static char text[41];
+    for (int col = 0; col < 40; col++)
+        text[col] = LcdChar(line, col - lcd.shift + 40);
+    text[40] = 0;
+    return text;
+}
+
+const uint8_t *SimLcdGlyph(int code) {
+    return &lcd.cgram[(code & 7) * 8];
+}
+
+// RGB backlight controller, auto-incrementing register pointer
+static struct {
+    uint8_t reg[16];
+    int     ptr;        // Register pointer, -1 until address byte
+    uint32_t color;
+} blt;
+
+static void BltStart(bool read) {
+    if (!read)
+        blt.ptr = -1;  // Reads carry on from the pointer last written
+}
+
+static void BltWrite(uint8_t b) {
+    if (blt.ptr < 0)
+        blt.ptr = b & 0x0F;
+    else {
+        blt.reg[blt.ptr] = b;
+        blt.ptr = (blt.ptr + 1) & 0x0F;
+    }
+}
+
+static uint8_t BltRead(void) {
+    if (blt.ptr < 0)
+        return 0;
+    uint8_t b = blt.reg[blt.ptr];
+    blt.ptr = (blt.ptr + 1) & 0x0F;
+    return b;
+}
+
+static void BltStop(void) {
+    uint32_t color = blt.reg[1] << 16 | blt.reg[2] << 8 | blt.reg[3];
+    if (color != blt.color && SimVerbose)
+        printf("%10.3f ms  Backlight #%06X\n", Millis(now), (unsigned)color);
+    blt.color = color;
+}
+
+// Quasi-bidirectional 8-bit port expanders (active-low LEDs and buttons)
+static uint8_t ledLatch = 0xFF;  // LED expander output latch
+static uint8_t buttons = 0;      // Buttons held, 1 = pressed
+static uint8_t buttonsRead = 0;  // ... as of the last read
+
+// The button expander's INT output, wired to PF3, is low while the
+// buttons differ from what was last read
+#define INT_PORT 5
+#define INT_BIT  3
+static bool DrivePin(int p, int bit, int level);
+
+static void PbInt(void) {
+    DrivePin(INT_PORT, INT_BIT, buttons == buttonsRead);
+}
+
+static void IoxStart(bool read) {
+    (void)read;
+}
+
+static void LedWrite(uint8_t b) {
+    if (b != ledLatch) {
+        if (SimVerbose)
+            printf("%10.3f ms  LEDs %02X\n", Millis(now), (uint8_t)~b);
+        ledLatch = b;
+        OutputChanged();
+    }
+}
+
+static uint8_t LedRead(void) {
+    return ledLatch;
+}
+
+static void PbWrite(uint8_t b) {
+    (void)b;
+}
+
+static uint8_t PbRead(void) {
+    buttonsRead = buttons;
+    PbInt();
+    return ~buttons;
+}
+
+static void IoxStop(void) {
+}
+
+static Device_t devices[] = {
+    {0x7C, "LCD",             LcdStart, LcdWrite, LcdRead, LcdStop, 0, 0},
+    {0x5A, "Backlight",       BltStart, BltWrite, BltRead, BltStop, 0, 0},
+    {0x70, "LED expander",    IoxStart, LedWrite, LedRead, IoxStop, 0, 0},
+    {0x72, "Button expander", IoxStart, PbWrite,  PbRead,  IoxStop, 0, 0},
+};
+#define NUM_DEVICES (int)(sizeof devices / sizeof devices[0])
+
+// --------------------------------------------------------
+// I2C2 controller
+// --------------------------------------------------------
+#define I2C (&Sim_I2C[1])
+#define TXDR_EMPTY 0xFFFFFFFF   // Marks TXDR as not yet written
+#define DMAMUX_I2C2_RX 19
+#define DMAMUX_I2C2_TX 20
+
+static struct {
+    enum {BUS_IDLE, BUS_ADDR, BUS_TX_WAIT, BUS_TX, BUS_RX, BUS_RX_FULL,
+          BUS_RELOAD, BUS_HOLD, BUS_STOP} phase;
+    Device_t *dev;
+    bool      rd, reload, autoend;
+    int       remaining;  // NBYTES left in this reload chunk
+    uint8_t   tx;         // Byte in the shift register
+    uint64_t  at;         // Time the current bus phase completes
+    uint64_t  rxSleep;    // Sleep count when RXNE was raised
+    bool      rxIrq;      // RXNE has been presented to the handler
+} bus;
+
+// DMA channel state not visible in registers (internal memory pointer)
+static struct {
+    bool     armed;
+    uint32_t ptr;
+    uint32_t mar;   // CM0AR and CNDTR as last seen, a change means the
+    uint32_t ndt;   // channel was reprogrammed without a visible disable
+} dmaCh[8];
+
+// Duration of one SCL period derived from TIMINGR, in kernel clocks
+// (PCLK1, which runs at the core clock)
+static uint64_t BitTime(void) {
+    uint32_t t = I2C->TIMINGR;
+    uint32_t presc = (t >> 28) + 1;
+    uint32_t scll = (t & 0xFF) + 1, sclh = ((t >> 8) & 0xFF) + 1;
+    return (presc * (scll + sclh) + 8) * cycle;  // Plus clock synchronization
+}
+
+static void BusBusy(int bits) {
+    SimStats.busTime += bits * BitTime();
+}
+
+static DMA_Channel_TypeDef *DmaChannel(int request) {
+    for (int i = 0; i < 8; i++)
+        if ((Sim_DMAMUX1_Channel[i].CCR & 0x7F) == (uint32_t)request
+                && dmaCh[i].armed && Sim_DMA1_Channel[i].CNDTR > 0)
+            return &Sim_DMA1_Channel[i];
+    return NULL;
+}
+
+static void DmaCount(DMA_Channel_TypeDef *ch) {
+    int i = ch - Sim_DMA1_Channel;
+    dmaCh[i].ptr++;
+    if (--ch->CNDTR == 0)
+        Sim_DMA1.ISR |= 2u << (4 * i);  // Transfer complete flag
+    dmaCh[i].ndt = ch->CNDTR;
+}
+
+static void EndOfCount(void) {
+    if (bus.reload) {
+        I2C->ISR |= I2C_ISR_TCR;
+        I2C->CR2 &= ~I2C_CR2_NBYTES;  // New NBYTES write resumes
+        bus.phase = BUS_RELOAD;
+    } else if (bus.autoend) {
+        bus.phase = BUS_STOP;
+        bus.at = now + BitTime();
+    } else {
+        I2C->ISR |= I2C_ISR_TC;
+        bus.phase = BUS_HOLD;
+    }
+}
+
+static void NextByte(void) {
+    if (bus.remaining == 0)
+        EndOfCount();
+    else if (bus.rd) {
+        bus.phase = BUS_RX;
+        bus.at = now + 9 * BitTime();
+    } else {
+        bus.phase = BUS_TX_WAIT;
+        I2C->TXDR = TXDR_EMPTY;
+        I2C->ISR |= I2C_ISR_TXIS | I2C_ISR_TXE;
+    }
+}
+
+static void LatchCR2(void) {
+    uint32_t cr2 = I2C->CR2;
+    bus.rd        = cr2 & I2C_CR2_RD_WRN;
+    bus.reload    = cr2 & I2C_CR2_RELOAD;
+    bus.autoend   = cr2 & I2C_CR2_AUTOEND;
+    bus.remaining = (cr2 & I2C_CR2_NBYTES) >> I2C_CR2_NBYTES_Pos;
+}
+
+// Apply register writes made by the firmware since the last look
+static void I2CSync(void) {
+    I2C->ISR &= ~(I2C->ICR & 0x3F38);  // Write-1-to-clear flags
+    I2C->ICR = 0;
+
+    if (!(I2C->CR1 & I2C_CR1_PE)) {
+        bus.phase = BUS_IDLE;
+        I2C->ISR = 0;
+        return;
+    }
+
+    if (I2C->CR2 & I2C_CR2_START) {
+        if (bus.phase != BUS_IDLE && bus.phase != BUS_HOLD)
+            fprintf(stderr, "sim: I2C START while bus phase %d\n", bus.phase);
+        if (bus.phase == BUS_HOLD && bus.dev)
+            bus.dev->stop();  // Repeated START ends the previous access
+        I2C->CR2 &= ~I2C_CR2_START;
+        I2C->ISR &= ~(I2C_ISR_TC | I2C_ISR_TCR | I2C_ISR_TXIS | I2C_ISR_RXNE);
+        I2C->ISR |= I2C_ISR_BUSY;
+        LatchCR2();
+        bus.phase = BUS_ADDR;
+        bus.at = now + 10 * BitTime();  // START plus address byte
+    }
+
+    if ((I2C->CR2 & I2C_CR2_STOP) && bus.phase == BUS_HOLD) {
+        I2C->CR2 &= ~I2C_CR2_STOP;
+        I2C->ISR &= ~I2C_ISR_TC;
+        bus.phase = BUS_STOP;
+        bus.at = now + BitTime();
+    }
+
+    if (bus.phase == BUS_RELOAD && (I2C->CR2 & I2C_CR2_NBYTES)) {
+        I2C->ISR &= ~I2C_ISR_TCR;
+        LatchCR2();
+        NextByte();
+    }
+
+    if (bus.phase == BUS_TX_WAIT) {
+        DMA_Channel_TypeDef *ch;
+        if (I2C->TXDR != TXDR_EMPTY)
+            bus.tx = I2C->TXDR;  // Written by the CPU
+        else if ((I2C->CR1 & I2C_CR1_TXDMAEN) && (ch = DmaChannel(DMAMUX_I2C2_TX))) {
+            bus.tx = *(uint8_t *)(uintptr_t)dmaCh[ch - Sim_DMA1_Channel].ptr;
+            DmaCount(ch);
+        } else
+            return;
+        I2C->ISR &= ~(I2C_ISR_TXIS | I2C_ISR_TXE);
+        bus.phase = BUS_TX;
+        bus.at = now + 9 * BitTime();
+    }
+
+    if (bus.phase == BUS_RX_FULL) {
+        DMA_Channel_TypeDef *ch;
+        // Read by the interrupt handler, or by the polling loop once it
+        // has gone back to sleep after RXNE was raised
+        bool consumed = bus.rxIrq || (!(I2C->CR1 & I2C_CR1_RXIE)
+                                      && sleeps > bus.rxSleep);
+        if ((I2C->CR1 & I2C_CR1_RXDMAEN) && (ch = DmaChannel(DMAMUX_I2C2_RX))) {
+            *(uint8_t *)(uintptr_t)dmaCh[ch - Sim_DMA1_Channel].ptr = I2C->RXDR;
+            DmaCount(ch);
+            consumed = true;
+        }
+        if (consumed) {
+            I2C->ISR &= ~I2C_ISR_RXNE;
+            NextByte();
+        }
+    }
+}
+
+// Complete the bus phase that was scheduled for this time
+static void I2CEvent(void) {
+    switch (bus.phase) {
+    case BUS_ADDR:
+        SimStats.starts++;
+        SimStats.bytes++;
+        BusBusy(10);
+        bus.dev = NULL;
+        for (int i = 0; i < NUM_DEVICES; i++)
+            if (devices[i].addr == (I2C->CR2 & 0xFE))
+                bus.dev = &devices[i];
+        if (bus.dev == NULL) {
+            I2C->ISR |= I2C_ISR_NACKF;
+            if (bus.autoend) {
+                bus.phase = BUS_STOP;
+                bus.at = now + BitTime();
+            } else
+                bus.phase = BUS_HOLD;
+            break;
+        }
+        bus.dev->xfers++;
+        bus.dev->start(bus.rd);
+        NextByte();
+        break;
+
+    case BUS_TX:
+        SimStats.bytes++;
+        bus.dev->bytes++;
+        BusBusy(9);
+        bus.dev->write(bus.tx);
+        bus.remaining--;
+        NextByte();
+        break;
+
+    case BUS_RX:
+        SimStats.bytes++;
+        bus.dev->bytes++;
+        BusBusy(9);
+        I2C->RXDR = bus.dev->read();
+        I2C->ISR |= I2C_ISR_RXNE;
+        bus.remaining--;
+        bus.phase = BUS_RX_FULL;
+        bus.rxSleep = sleeps;
+        bus.rxIrq = false;
+        break;
+
+    case BUS_STOP:
+        BusBusy(1);
+        if (bus.dev)
+            bus.dev->stop();
+        bus.dev = NULL;
+        I2C->ISR &= ~(I2C_ISR_BUSY | I2C_ISR_TC | I2C_ISR_TCR);
+        I2C->ISR |= I2C_ISR_STOPF;
+        bus.phase = BUS_IDLE;
+        break;
+
+    default:
+        break;
+    }
+}
+
+static bool I2CTimed(void) {
+    return bus.phase == BUS_ADDR || bus.phase == BUS_TX
+        || bus.phase == BUS_RX || bus.phase == BUS_STOP;
+}
+
+// Event and error interrupt requests
+static uint32_t I2CEventIRQ(void) {
+    uint32_t cr1 = I2C->CR1, en = 0;
+    if (cr1 & I2C_CR1_TXIE)   en |= I2C_ISR_TXIS;
+    if (cr1 & I2C_CR1_RXIE)   en |= I2C_ISR_RXNE;
+    if (cr1 & I2C_CR1_TCIE)   en |= I2C_ISR_TC | I2C_ISR_TCR;
+    if (cr1 & I2C_CR1_STOPIE) en |= I2C_ISR_STOPF;
+    if (cr1 & I2C_CR1_NACKIE) en |= I2C_ISR_NACKF;
+    return I2C->ISR & en;
+}
+
+static uint32_t I2CErrorIRQ(void) {
+    if (!(I2C->CR1 & I2C_CR1_ERRIE))
+        return 0;
+    return I2C->ISR & (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_OVR);
+}
+
+// --------------------------------------------------------
+// DMA channels
+// --------------------------------------------------------
+static void DmaSync(void) {
+    for (int i = 0; i < 8; i++) {
+        DMA_Channel_TypeDef *ch = &Sim_DMA1_Channel[i];
+        bool en = ch->CCR & DMA_CCR_EN;
+        if (en && (!dmaCh[i].armed || ch->CM0AR != dmaCh[i].mar
+                                   || ch->CNDTR != dmaCh[i].ndt))
+            dmaCh[i].ptr = ch->CM0AR;
+        dmaCh[i].armed = en;
+        dmaCh[i].mar = ch->CM0AR;
+        dmaCh[i].ndt = ch->CNDTR;
+    }
+}
+
+// --------------------------------------------------------
+// SysTick
+// --------------------------------------------------------
+static bool tickOn = false;
+static uint64_t tickStart;   // Start of the current count-down period
+static uint32_t tickLoad;    // Reload value latched for this period
+static uint32_t tickVal;     // VAL as last presented to the firmware
+
+static uint64_t TickEnd(void) {
+    return tickStart + (tickLoad + 1) * cycle;
+}
+
+static void TickSync(void) {
+    bool on = Sim_SysTick.CTRL & SysTick_CTRL_ENABLE_Msk;
+    if (on && (!tickOn || Sim_SysTick.VAL != tickVal)) {
+        // Enabled or VAL written: count down from LOAD starting now
+        tickStart = now;
+        tickLoad = Sim_SysTick.LOAD & 0xFFFFFF;
+        Sim_SysTick.CTRL &= ~SysTick_CTRL_COUNTFLAG_Msk;
+    }
+    tickOn = on;
+    if (tickOn)
+        Sim_SysTick.VAL = tickLoad - (uint32_t)((now - tickStart) / cycle);
+    tickVal = Sim_SysTick.VAL;
+}
+
+// Every firmware access sees the live count and has its VAL writes
+// noticed before the next access (e.g. a LOAD written right after)
+SysTick_Type *SimSysTick(void) {
+    TickSync();
+    return &Sim_SysTick;
+}
+
+static void TickEvent(void) {
+    SimStats.ticks++;
+    tickStart = now;
+    tickLoad = Sim_SysTick.LOAD & 0xFFFFFF;
+    Sim_SysTick.CTRL |= SysTick_CTRL_COUNTFLAG_Msk;
+    if (Sim_SysTick.CTRL & SysTick_CTRL_TICKINT_Msk)
+        SCB->ICSR |= SCB_ICSR_PENDSTSET_Msk;
+}
+
+// --------------------------------------------------------
+// Clocks
+// --------------------------------------------------------
+// Highest HCLK for each voltage range, and for each flash wait state
+// within it (RM0438 flash latency table)
+static const uint32_t rangeMHz[3] = {110, 80, 26};
+static const uint32_t wsMHz[3][6] = {
+    {20, 40, 60, 80, 100, 110},
+    {20, 40, 60, 80, 80, 80},
+    {8, 16, 26, 26, 26, 26},
+};
+
+static void SetCoreClock(uint32_t hz) {
+    if (SIM_HZ % hz) {
+        fprintf(stderr, "sim: %u Hz core clock does not divide the time base\n",
+                (unsigned)hz);
+        exit(2);
+    }
+    uint32_t range = (Sim_PWR.CR1 & PWR_CR1_VOS) >> PWR_CR1_VOS_Pos;
+    uint32_t ws = Sim_FLASH.ACR & FLASH_ACR_LATENCY;
+    if (range > 2 || hz > rangeMHz[range] * 1000000)
+        fprintf(stderr, "sim: %u MHz core clock in voltage range %u\n",
+                (unsigned)(hz / 1000000), (unsigned)range);
+    else if (ws > 5 || hz > wsMHz[range][ws] * 1000000)
+        fprintf(stderr, "sim: %u MHz core clock with %u flash wait states\n",
+                (unsigned)(hz / 1000000), (unsigned)ws);
+
+    // SysTick carries on counting at the new rate
+    uint64_t counted = (now - tickStart) / cycle;
+    cycle = SIM_HZ / hz;
+    tickStart = now - counted * cycle;
+    coreHz = hz;
+    if (SimVerbose)
+        printf("%10.3f ms  Core clock %u MHz\n", Millis(now),
+               (unsigned)(hz / 1000000));
+}
+
+// The PLL locks and the system clock switches as soon as asked
+static void RccSync(void) {
+    static const uint16_t hpreDiv[8] = {2, 4, 8, 16, 64, 128, 256, 512};
+    RCC_TypeDef *rcc = &Sim_RCC;
+
+    if (rcc->CR & RCC_CR_PLLON)
+        rcc->CR |= RCC_CR_PLLRDY;
+    else
+        rcc->CR &= ~RCC_CR_PLLRDY;
+
+    uint32_t sw = rcc->CFGR & RCC_CFGR_SW;
+    if (sw != 0 && sw != 3) {
+        fprintf(stderr, "sim: only MSI and PLL system clocks are modeled\n");
+        exit(2);
+    }
+    if (sw == 3 && !(rcc->CR & RCC_CR_PLLRDY))
+        sw = (rcc->CFGR & RCC_CFGR_SWS) >> RCC_CFGR_SWS_Pos;  // Stays put
+    rcc->CFGR = (rcc->CFGR & ~RCC_CFGR_SWS) | sw << RCC_CFGR_SWS_Pos;
+
+    uint64_t hz = MSI_HZ;
+    if (sw == 3) {
+        uint32_t pll = rcc->PLLCFGR;
+        uint32_t m = ((pll & RCC_PLLCFGR_PLLM) >> RCC_PLLCFGR_PLLM_Pos) + 1;
+        uint32_t n = (pll & RCC_PLLCFGR_PLLN) >> RCC_PLLCFGR_PLLN_Pos;
+        uint32_t r = 2 * (((pll & RCC_PLLCFGR_PLLR) >> RCC_PLLCFGR_PLLR_Pos) + 1);
+        hz = hz / m * n / r;
+    }
+    uint32_t hpre = (rcc->CFGR & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_Pos;
+    if (hpre & 8)
+        hz /= hpreDiv[hpre & 7];
+
+    if (hz != coreHz)
+        SetCoreClock(hz);
+}
+
+// Every firmware access sees the ready flags of its last write
+RCC_TypeDef *SimRCC(void) {
+    RccSync();
+    return &Sim_RCC;
+}
+
+// --------------------------------------------------------
+// ITM
+// --------------------------------------------------------
+// A trace probe is attached with stimulus ports 0 and 1 enabled, and
+// its FIFO is never full. Records on the log port are decoded the way
+// Tools/logdecode.py does it, except that the format string is read
+// straight from memory.
+static uint32_t logRecord[1 + LOG_MAX_ARGS];
+static int logWords = 0;
+
+void SimITMSend32(uint32_t port, uint32_t w) {
+    if (port != LOG_PORT)
+        return;
+    logRecord[logWords++] = w;
+    if (logWords <= (int)(logRecord[0] & LOG_MAX_ARGS))
+        return;  // Arguments still to come
+
+    char text[128];
+    const char *fmt = (const char *)(uintptr_t)(logRecord[0] & ~LOG_MAX_ARGS);
+    snprintf(text, sizeof text, fmt, (unsigned long)logRecord[1],
+             (unsigned long)logRecord[2], (unsigned long)logRecord[3]);
+    printf("%10.3f ms  %s\n", Millis(now), text);
+    SimStats.logRecords++;
+    logWords = 0;
+}
+
+// --------------------------------------------------------
+// GPIO and EXTI
+// --------------------------------------------------------
+static uint32_t extiRise = 0, extiFall = 0;  // Pending edges per line
+static uint16_t lastODR[8];
+
+static void GpioSync(void) {
+    for (int p = 0; p < 8; p++) {
+        GPIO_TypeDef *port = (GPIO_TypeDef *)Sim_GPIOMem[p];
+        uint32_t bsrr = port->BSRR;
+        port->BSRR = 0;
+        port->ODR = (port->ODR | (bsrr & 0xFFFF)) & ~(bsrr >> 16);
+        if ((port->ODR & 0xFFFF) != lastODR[p]) {
+            if (SimVerbose)
+                printf("%10.3f ms  GPIO%c ODR %04X\n", Millis(now), 'A' + p,
+                       (unsigned)(port->ODR & 0xFFFF));
+            lastODR[p] = port->ODR & 0xFFFF;
+            OutputChanged();
+        }
+    }
+}
+
+// Set an input pin level, returns whether it changed
+static bool DrivePin(int p, int bit, int level) {
+    GPIO_TypeDef *port = (GPIO_TypeDef *)Sim_GPIOMem[p];
+    uint32_t mask = 1u << bit;
+    bool was = port->IDR & mask;
+    if (was == (level != 0))
+        return false;
+    port->IDR = level ? port->IDR | mask : port->IDR & ~mask;
+
+    // Edge detection on lines routed to this port
+    uint32_t sel = (EXTI->EXTICR[bit / 4] >> (8 * (bit % 4))) & 0xFF;
+    if (!(EXTI->IMR1 & mask) || sel != (uint32_t)p)
+        return true;
+    if (level && (EXTI->RTSR1 & mask))
+        extiRise |= mask;
+    if (!level && (EXTI->FTSR1 & mask))
+        extiFall |= mask;
+    return true;
+}
+
+// Pin driven from outside the board
+static void SetPin(int p, int bit, int level) {
+    if (DrivePin(p, bit, level))
+        InputChanged();
+}
+
+// --------------------------------------------------------
+// Scenario events
+// --------------------------------------------------------
+typedef struct {
+    uint64_t at;
+    int      port;   // -1 for expander button
+    int      bit;
+    int      level;
+} Event_t;
+
+#define MAX_EVENTS 256
+static Event_t events[MAX_EVENTS];
+static int numEvents = 0, nextEvent = 0;
+
+static void AddEvent(uint32_t ms, int port, int bit, int level) {
+    if (numEvents == MAX_EVENTS) {
+        fprintf(stderr, "sim: too many events\n");
+        exit(2);
+    }
+    // Keep list sorted by time, stable for equal times
+    int i = numEvents++;
+    while (i > 0 && events[i - 1].at > (uint64_t)ms * MS) {
+        events[i] = events[i - 1];
+        i--;
+    }
+    events[i] = (Event_t){(uint64_t)ms * MS, port, bit, level};
+}
+
+void SimButton(uint32_t ms, int button, int pressed) {
+    AddEvent(ms, -1, button, pressed);
+}
+
+void SimPin(uint32_t ms, GPIO_TypeDef *port, int bit, int level) {
+    AddEvent(ms, ((uint8_t *)port - Sim_GPIOMem[0]) / 0x400, bit, level);
+}
+
+static void ScenarioEvent(void) {
+    Event_t *e = &events[nextEvent++];
+    if (e->port < 0) {
+        uint8_t mask = 1u << e->bit;
+        uint8_t was = buttons;
+        buttons = e->level ? buttons | mask : buttons & ~mask;
+        if (buttons != was) {
+            InputChanged();
+            PbInt();
+        }
+    } else
+        SetPin(e->port, e->bit, e->level);
+}
+
+// --------------------------------------------------------
+// Interrupt dispatch
+// --------------------------------------------------------
+static void Sync(void) {
+    for (int i = 0; i < 4; i++) {
+        NVIC->ICPR[i] = 0;
+        NVIC->ISPR[i] = 0;
+    }
+    RccSync();
+    GpioSync();
+    DmaSync();
+    TickSync();
+    I2CSync();
+}
+
+static void Enter(void (*handler)(void)) {
+    SimStats.irqs++;
+    handlerDepth++;
+    handler();
+    handlerDepth--;
+    Sync();
+}
+
+// Any enabled interrupt waiting to be taken
+static bool Pending(void) {
+    for (int line = 0; line < 16; line++)
+        if (((extiRise | extiFall) & (1u << line)) && IrqEnabled(EXTI0_IRQn + line))
+            return true;
+    return (I2CErrorIRQ() && IrqEnabled(I2C2_ER_IRQn))
+        || (I2CEventIRQ() && IrqEnabled(I2C2_EV_IRQn))
+        || (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk);
+}
+
+// Run pending handlers in priority order, returns true if any ran.
+// With interrupts masked nothing runs, but a pending one still ends WFI.
+static bool Dispatch(void) {
+    bool any = false;
+    for (int guard = 0; guard < 10000; guard++) {
+        Sync();
+        if (primask)
+            return any || Pending();
+
+        uint32_t exti = extiRise | extiFall;
+        int line = 0;
+        while (line < 16 && !(exti & (1u << line) && IrqEnabled(EXTI0_IRQn + line)))
+            line++;
+        if (line < 16) {
+            uint32_t mask = 1u << line;
+            EXTI->RPR1 = extiRise & mask;
+            EXTI->FPR1 = extiFall & mask;
+            extiRise &= ~mask;
+            extiFall &= ~mask;
+            Enter(extiHandler[line]);
+            EXTI->RPR1 = EXTI->FPR1 = 0;
+            any = true;
+            continue;
+        }
+
+        if (I2CErrorIRQ() && IrqEnabled(I2C2_ER_IRQn)) {
+            Enter(I2C2_ER_IRQHandler);
+            any = true;
+            continue;
+        }
+        if (I2CEventIRQ() && IrqEnabled(I2C2_EV_IRQn)) {
+            if (I2C->ISR & I2C_ISR_RXNE)
+                bus.rxIrq = true;  // Handler reads RXDR
+            Enter(I2C2_EV_IRQHandler);
+            any = true;
+            continue;
+        }
+
+        if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+            SCB->ICSR &= ~SCB_ICSR_PENDSTSET_Msk;
+            Enter(SysTick_Handler);
+            any = true;
+            continue;
+        }
+        return any;
+    }
+    fprintf(stderr, "sim: interrupt storm at %.3f ms\n", Millis(now));
+    exit(3);
+}
+
+// Sleep until an interrupt has been handled, advancing simulated time
+void SimWFI(void) {
+    sleeps++;
+    while (!Dispatch()) {
+        uint64_t next = endTime;
+        if (tickOn && (Sim_SysTick.CTRL & SysTick_CTRL_TICKINT_Msk) && TickEnd() < next)
+            next = TickEnd();
+        if (I2CTimed() && bus.at < next)
+            next = bus.at;
+        if (nextEvent < numEvents && events[nextEvent].at < next)
+            next = events[nextEvent].at;
+
+        now = next;
+        SimStats.time = now;
+        if (now >= endTime)
+            longjmp(simExit, 1);
+
+        if (tickOn && TickEnd() == now)
+            TickEvent();
+        if (I2CTimed() && bus.at == now)
+            I2CEvent();
+        while (nextEvent < numEvents && events[nextEvent].at == now)
+            ScenarioEvent();
+    }
+    SimStats.wakeups++;
+}
+
+// --------------------------------------------------------
+// Running and reporting
+// --------------------------------------------------------
+void SimRun(int (*firmware)(void), uint32_t ms) {
+    I2C->TXDR = TXDR_EMPTY;
+    Sim_PWR.CR1 = PWR_CR1_VOS_1;  // Reset values: voltage range 2
+    Sim_RCC.CR = RCC_CR_MSION | RCC_CR_MSIRDY;
+    Sim_ITM.TCR = ITM_TCR_ITMENA_Msk;  // Set up by the probe
+    Sim_ITM.TER = 1u << 0 | 1u << LOG_PORT;
+    Sim_ITM.PORT[LOG_PORT].u32 = 1;   // FIFOREADY
+    memset(lcd.ddram, ' ', sizeof lcd.ddram);
+    PbInt();
+    endTime = (uint64_t)ms * MS;
+    if (setjmp(simExit) == 0) {
+        firmware();
+        fprintf(stderr, "sim: firmware returned from main()\n");
+    }
+    SimStats.time = now;
+}
+
+void SimReport(FILE *f) {
+    double ms = Millis(SimStats.time);
+    fprintf(f, "Simulated time   %.3f ms\n", ms);
+    fprintf(f, "SysTick periods  %llu\n", (unsigned long long)SimStats.ticks);
+    fprintf(f, "Wakeups          %llu\n", (unsigned long long)SimStats.wakeups);
+    fprintf(f, "Interrupts       %llu\n", (unsigned long long)SimStats.irqs);
+    fprintf(f, "Log records      %llu\n", (unsigned long long)SimStats.logRecords);
+    fprintf(f, "I2C starts       %llu\n", (unsigned long long)SimStats.starts);
+    fprintf(f, "I2C bytes        %llu\n", (unsigned long long)SimStats.bytes);
+    fprintf(f, "I2C bus busy     %.1f %%\n",
+            SimStats.time ? 100.0 * SimStats.busTime / SimStats.time : 0.0);
+    for (int i = 0; i < NUM_DEVICES; i++)
+        fprintf(f, "  0x%02X %-16s %8llu transfers %8llu bytes\n",
+                devices[i].addr, devices[i].name,
+                (unsigned long long)devices[i].xfers,
+                (unsigned long long)devices[i].bytes);
+    if (SimStats.latencyN)
+        fprintf(f, "Input->output    n=%llu min %.3f avg %.3f max %.3f ms\n",
+                (unsigned long long)SimStats.latencyN,
+                Millis(SimStats.latencyMin),
+                Millis(SimStats.latencySum / SimStats.latencyN),
+                Millis(SimStats.latencyMax));
+    fprintf(f, "LCD              |%.16s|\n", lcd.shown[0]);
+    fprintf(f, "                 |%.16s|\n", lcd.shown[1]);
+    fprintf(f, "Backlight        #%06X\n", (unsigned)blt.color);
+    fprintf(f, "LEDs             %02X\n", (uint8_t)~ledLatch);
+}
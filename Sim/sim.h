@@ -0,0 +1,62 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32l5xx.h"
+
+// Simulated time base, a whole multiple of every core clock the
+// firmware selects (4 MHz MSI, 55 and 110 MHz PLL)
+#define SIM_HZ 440000000
+
+// --------------------------------------------------------
+// Measurements collected while the firmware runs
+// --------------------------------------------------------
+typedef struct {
+    uint64_t time;         // Simulated time, in units of 1 / SIM_HZ
+    uint64_t ticks;        // SysTick periods elapsed
+    uint64_t wakeups;      // Returns from WFI (main loop passes)
+    uint64_t irqs;         // Interrupt handlers entered
+
+    uint64_t starts;       // I2C START conditions (incl. repeated)
+    uint64_t bytes;        // I2C bytes clocked, address bytes included
+    uint64_t busTime;      // Time the I2C bus was occupied
+
+    uint64_t logRecords;   // LOG() records received over ITM
+
+    uint64_t latencyN;     // Input change to output change samples
+    uint64_t latencyMin;   // ... in simulated time
+    uint64_t latencyMax;
+    uint64_t latencySum;
+} SimStats_t;
+
+extern SimStats_t SimStats;
+extern bool SimVerbose;      // Trace display and LED changes
+
+// --------------------------------------------------------
+// Scenario
+// --------------------------------------------------------
+// Press (1) or release (0) one of the 8 expander buttons (GPIOX 15:8)
+void SimButton(uint32_t ms, int button, int pressed);
+
+// Drive an MCU input pin, raising EXTI edges where configured
+void SimPin(uint32_t ms, GPIO_TypeDef *port, int bit, int level);
+
+// Run the firmware entry point for the given simulated time
+void SimRun(int (*firmware)(void), uint32_t ms);
+
+// Print measurements and final device state
+void SimReport(FILE *f);
+
+// Text of LCD line 0 or 1 as shown at the last STOP, 16 characters
+const char *SimLcdLine(int line);
+
+// All 40 columns of LCD line 0 or 1 in display memory, from address 0
+// and as it is now, characters shown as by SimLcdLine()
+const char *SimLcdMemory(int line);
+
+// The 8 pattern rows in CGRAM of a custom character code, as they are now
+const uint8_t *SimLcdGlyph(int code);
+
+#endif /* SIM_H_ */
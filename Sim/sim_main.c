@@ -0,0 +1,59 @@
+// Board simulator command line
+//
+//   sim [-v] [-t ms] [event ...]
+//
+// Events are "<ms>:press:<n>" / "<ms>:release:<n>" for expander button n
+// (0-7, GPIOX bits 15:8) and "<ms>:pin:<port><bit>=<level>" for an MCU
+// input pin, e.g. "1500:pin:B9=1" for the motion sensor.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sim.h"
+
+int FirmwareMain(void);  // main() in Src/main.c
+
+static void Usage(void) {
+    fprintf(stderr, "usage: sim [-v] [-t ms] [<ms>:press:<n> | <ms>:release:<n> |"
+                    " <ms>:pin:<port><bit>=<level>] ...\n");
+    exit(1);
+}
+
+static bool ParseEvent(const char *arg) {
+    unsigned ms, n, level;
+    char port;
+    if (sscanf(arg, "%u:press:%u", &ms, &n) == 2 && n < 8)
+        SimButton(ms, n, 1);
+    else if (sscanf(arg, "%u:release:%u", &ms, &n) == 2 && n < 8)
+        SimButton(ms, n, 0);
+    else if (sscanf(arg, "%u:pin:%c%u=%u", &ms, &port, &n, &level) == 4
+             && port >= 'A' && port <= 'H' && n < 16)
+        SimPin(ms, (GPIO_TypeDef *)Sim_GPIOMem[port - 'A'], n, level);
+    else
+        return false;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    uint32_t ms = 1000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vt:")) != -1) {
+        switch (opt) {
+        case 'v': SimVerbose = true; break;
+        case 't': ms = strtoul(optarg, NULL, 0); break;
+        default:  Usage();
+        }
+    }
+    for (int i = optind; i < argc; i++)
+        if (!ParseEvent(argv[i]))
+            Usage();
+
+    // Busy-wait loops never reach WFI, so simulated time stops; give up
+    // after a generous amount of host time.
+    alarm(60);
+
+    SimRun(FirmwareMain, ms);
+    SimReport(stdout);
+    return 0;
+}
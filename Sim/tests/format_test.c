@@ -0,0 +1,105 @@
+// Display text formatting regression test
+//
+// Lines printed with each conversion, flag, width and precision the
+// display supports go out to the LCD and must read as printf would
+// print them, a NULL string as "(null)". A marquee longer than the
+// controller's line memory is clipped at its 40 columns, leaving the
+// other line blank.
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "sim.h"
+#include "systick.h"
+#include "timer.h"
+#include "i2c.h"
+#include "display.h"
+
+#define RUN_MS  2000
+#define SHOW_MS 20  // Passes for the display to queue both lines
+
+static int errors = 0;
+static int checked = 0;
+
+// Run the display until the committed frame is on the LCD: the bus
+// stays idle through a pass, so the display has nothing more to queue
+// (the polled engine takes a step each millisecond)
+static void Show(void) {
+    DisplayCommit();
+    Time_t start = TimeNow();
+    int idle = 0;  // Passes in a row ending with the bus idle
+    while (TimePassed(start) < SHOW_MS || idle < 2) {
+        TimerService();
+        UpdateDisplay();
+        ServiceI2CRequests();
+        idle = I2C_Idle() ? idle + 1 : 0;
+        WakeAt(TimeNow() + 1);
+        WaitForEvent();
+    }
+}
+
+static void Expect(const char *fmt, const char *got, const char *want) {
+    checked++;
+    if (strcmp(got, want) == 0)
+        return;
+    printf("format_test: \"%s\" gave |%s|, expected |%s|\n", fmt, got, want);
+    errors++;
+}
+
+// Print on line 1 and compare with the text, padded out to the display
+#define LINE(want, fmt, ...) do {                     \
+        char pad[17];                                 \
+        snprintf(pad, sizeof pad, "%-16s", want);     \
+        DisplayPrint(0, fmt, __VA_ARGS__);            \
+        Show();                                       \
+        Expect(fmt, SimLcdLine(0), pad);              \
+    } while (0)
+
+static int Firmware(void) {
+    StartSysTick();
+    DisplayEnable();
+
+    // Width and flags
+    LINE("   42|",          "%5d|", 42);
+    LINE("-42  |",          "%-5d|", -42);
+    LINE("-0042",           "%05d", -42);
+    LINE("-2147483648",     "%d", INT_MIN);
+    LINE("4294967295",      "%u", UINT_MAX);
+    LINE("beef BEEF 001f",  "%x %X %04x", 0xBEEFu, 0xBEEFu, 0x1Fu);
+    LINE("a  b%",           "%c%3c%%", 'a', 'b');
+
+    // Precision: fixed-point decimals, clamped at 10, and string length
+    LINE("12.34",           "%.2d", 1234);
+    LINE("-0.05",           "%.2d", -5);
+    LINE("  0.7",           "%5.1u", 7u);
+    LINE("0.0000000005",    "%.12u", 5u);
+    LINE("abc|ab  |",       "%.3s|%-4s|", "abcdef", "ab");
+    LINE("[(null)]",        "[%s]", (const char *)NULL);
+    LINE("[(nu]",           "[%.3s]", (const char *)NULL);
+
+    // Clipped at the end of line memory: 50 characters, 40 shown (all
+    // written, with the other line blank for the display to shift)
+    static const char digits[] = "0123456789";
+    DisplayPrint(1, "");
+    DisplayMarquee(0, "%s%s%s%s%s", digits, digits, digits, "ABCDEFGHIJ",
+                   "KLMNOPQRST");
+    Show();
+    Expect("marquee", SimLcdMemory(0),
+           "012345678901234567890123456789ABCDEFGHIJ");
+    Expect("other line", SimLcdMemory(1),
+           "                                        ");
+
+    while (1)
+        WaitForEvent();
+    return 0;
+}
+
+int main(void) {
+    SimRun(Firmware, RUN_MS);
+
+    if (checked != 16) {
+        printf("format_test: %d of 16 lines checked\n", checked);
+        errors++;
+    }
+    printf("format_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
@@ -0,0 +1,137 @@
+// Custom character slot regression test
+//
+// Eight glyphs on display fill the controller's 8 CGRAM slots, and each
+// must show its own pattern. A ninth gets the fallback while they are
+// on display, even once the app has drawn over them, for as long as
+// the frame on the LCD still shows them. Once gone, new glyphs take
+// the least recently used slots first, and are uploaded before the
+// frame showing them.
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "systick.h"
+#include "timer.h"
+#include "i2c.h"
+#include "display.h"
+
+#define RUN_MS   2000
+#define SHOW_MS  20  // Passes for the display to queue both lines
+#define PATTERNS 13
+
+static uint8_t pattern[PATTERNS][8];
+static int errors = 0;
+static bool finished = false;
+
+// Run the display until the committed frame is on the LCD: the bus
+// stays idle through a pass, so the display has nothing more to queue
+static void Show(void) {
+    DisplayCommit();
+    Time_t start = TimeNow();
+    int idle = 0;  // Passes in a row ending with the bus idle
+    while (TimePassed(start) < SHOW_MS || idle < 2) {
+        TimerService();
+        UpdateDisplay();
+        ServiceI2CRequests();
+        idle = I2C_Idle() ? idle + 1 : 0;
+        WakeAt(TimeNow() + 1);
+        WaitForEvent();
+    }
+}
+
+// Line 1 showing a character for each of n patterns
+static void Draw(const int *which, int n, char *codes) {
+    char text[17];
+    for (int i = 0; i < n; i++)
+        text[i] = codes[which[i]] = DisplayGlyph(pattern[which[i]], '?');
+    text[n] = 0;
+    DisplayPrint(0, "%s", text);
+}
+
+static void Expect(const char *what, int got, int want) {
+    if (got == want)
+        return;
+    printf("glyph_test: %s %d, expected %d\n", what, got, want);
+    errors++;
+}
+
+// Each glyph on line 1 shows on the LCD with its own pattern
+static void ExpectShown(const int *which, int n, const char *codes) {
+    char want[17];
+    memset(want, ' ', 16);
+    memset(want, '+', n);
+    want[16] = 0;
+    if (strcmp(SimLcdLine(0), want) != 0) {
+        printf("glyph_test: LCD |%s|, expected |%s|\n", SimLcdLine(0), want);
+        errors++;
+    }
+    for (int i = 0; i < n; i++) {
+        int p = which[i];
+        if (memcmp(SimLcdGlyph(codes[p]), pattern[p], 8) != 0) {
+            printf("glyph_test: code %d does not show pattern %d\n",
+                   codes[p], p);
+            errors++;
+        }
+    }
+}
+
+static int Firmware(void) {
+    static const int all[] = {0, 1, 2, 3, 4, 5, 6, 7};
+    static const int kept[] = {0, 1, 2, 3};
+    static const int added[] = {0, 1, 2, 3, 8, 9, 10, 11};
+    char codes[PATTERNS] = {0};
+
+    StartSysTick();
+    DisplayEnable();
+
+    // Eight glyphs, one per slot
+    Draw(all, 8, codes);
+    Show();
+    ExpectShown(all, 8, codes);
+    for (int i = 0; i < 8; i++)
+        for (int j = 0; j < i; j++)
+            if (codes[i] == codes[j]) {
+                printf("glyph_test: patterns %d and %d share code %d\n",
+                       i, j, codes[i]);
+                errors++;
+            }
+
+    // No slot to spare while they are on the LCD, though the app has
+    // drawn over half of them
+    Draw(kept, 4, codes);
+    Expect("ninth glyph while shown", DisplayGlyph(pattern[8], '?'), '?');
+
+    // Once off the LCD, those slots go to new glyphs least recently
+    // used first: 4, 5 and 7, then 6, used again just now
+    Expect("pattern 6 used again", DisplayGlyph(pattern[6], '?'), codes[6]);
+    Show();
+    char old[PATTERNS];
+    memcpy(old, codes, sizeof old);
+    Draw(added, 8, codes);
+    Expect("pattern 8 code", codes[8], old[4]);
+    Expect("pattern 9 code", codes[9], old[5]);
+    Expect("pattern 10 code", codes[10], old[7]);
+    Expect("pattern 11 code", codes[11], old[6]);
+    Expect("thirteenth glyph", DisplayGlyph(pattern[12], '?'), '?');
+    Show();
+    ExpectShown(added, 8, codes);
+    finished = true;
+
+    while (1)
+        WaitForEvent();
+    return 0;
+}
+
+int main(void) {
+    for (int i = 0; i < PATTERNS; i++)
+        for (int r = 0; r < 8; r++)
+            pattern[i][r] = (i + r) & 0x1F;  // Row 0 tells them apart
+
+    SimRun(Firmware, RUN_MS);
+
+    if (!finished) {
+        printf("glyph_test: scenario did not complete\n");
+        errors++;
+    }
+    printf("glyph_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
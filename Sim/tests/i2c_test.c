@@ -0,0 +1,149 @@
+// I2C engine regression test
+//
+// A register read, written as an address segment followed by a read
+// segment, must turn the bus around with a repeated START. A write of
+// more than 255 bytes must be sent in NBYTES chunks joined by RELOAD,
+// by DMA when the engine is interrupt driven. A transfer requested
+// again while it waits in the queue must not break the queue.
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "systick.h"
+#include "i2c.h"
+
+#define RUN_MS   2000
+#define LONG_LEN 300  // LCD data bytes, wraps DDRAM (2 x 40) almost 4 times
+
+// Backlight registers 0-6, then read back from register 1 onwards
+static uint8_t bltSet[7] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66};
+static uint8_t bltReg = 0x01;
+static uint8_t bltGot[5];
+static const I2C_Seg_t bltRead[] = {{bltGot, sizeof bltGot, true}};
+
+// LED expander latch written, then read back on one byte each way
+static uint8_t ledSet = 0xA5;
+static uint8_t ledGot;
+static const I2C_Seg_t ledRead[] = {{&ledGot, 1, true}};
+
+// LCD: set DDRAM address 0, then a data stream as one buffer
+static uint8_t lcdLong[3 + LONG_LEN] = {0x80, 0x80, 0x40};
+
+static I2C_Xfer_t xfers[] = {
+    {&LeafyI2C, 0x5A, bltSet, sizeof bltSet, 1, 0, NULL},
+    {&LeafyI2C, 0x5A, &bltReg, 1, 1, 0, NULL, I2C_LOW, bltRead, 1},
+    {&LeafyI2C, 0x70, &ledSet, 1, 1, 0, NULL, I2C_LOW, ledRead, 1},
+    {&LeafyI2C, 0x7C, lcdLong, sizeof lcdLong, 1, 0, NULL},
+};
+#define XFERS (int)(sizeof xfers / sizeof xfers[0])
+
+// Bytes on the bus for each transfer, address bytes included
+static uint64_t bytes[XFERS];
+static uint64_t starts[XFERS];
+static int done = 0;
+static uint64_t requeuedBytes = 0;  // ... of the transfers requested again
+static bool requeued = false;
+
+static void Drain(I2C_Xfer_t *x) {
+    while (x->busy || !I2C_Idle()) {
+        ServiceI2CRequests();
+        WaitForEvent();
+    }
+}
+
+static int Firmware(void) {
+    StartSysTick();
+    I2C_Device(&LeafyI2C, 0x5A, I2C_FAST);
+    I2C_Device(&LeafyI2C, 0x70, I2C_FAST);
+    I2C_Device(&LeafyI2C, 0x7C, I2C_FAST);
+    I2C_Enable(LeafyI2C);
+
+    // One at a time, so that each can be measured on its own
+    for (; done < XFERS; done++) {
+        uint64_t b = SimStats.bytes, s = SimStats.starts;
+        I2C_Request(&xfers[done]);
+        Drain(&xfers[done]);  // Up to the last STOP
+        bytes[done] = SimStats.bytes - b;
+        starts[done] = SimStats.starts - s;
+    }
+
+    // Transfers requested again while waiting in the queue, in the
+    // middle and at the tail, stay in their place and go out once
+    uint64_t b = SimStats.bytes;
+    I2C_Request(&xfers[3]);  // Long write, keeps the bus
+    I2C_Request(&xfers[0]);
+    I2C_Request(&xfers[2]);
+    I2C_Request(&xfers[0]);  // In the middle
+    Drain(&xfers[2]);
+    I2C_Request(&xfers[3]);
+    I2C_Request(&xfers[0]);
+    I2C_Request(&xfers[0]);  // At the tail
+    Drain(&xfers[0]);
+    requeuedBytes = SimStats.bytes - b;
+    requeued = true;
+
+    while (1)
+        WaitForEvent();
+    return 0;
+}
+
+static int Expect(const char *what, uint64_t got, uint64_t want) {
+    if (got == want)
+        return 0;
+    printf("i2c_test: %s %llu, expected %llu\n", what,
+           (unsigned long long)got, (unsigned long long)want);
+    return 1;
+}
+
+int main(void) {
+    int errors = 0;
+
+    for (int i = 0; i < LONG_LEN; i++)
+        lcdLong[3 + i] = 'A' + i % 26;
+
+    SimRun(Firmware, RUN_MS);
+
+    if (done != XFERS) {
+        printf("i2c_test: %d of %d transfers completed\n", done, XFERS);
+        printf("i2c_test: FAILED\n");
+        return 1;
+    }
+
+    // Register read: START, address, register, repeated START, address,
+    // then the data
+    errors += Expect("register read starts", starts[1], 2);
+    errors += Expect("register read bytes", bytes[1], 2 + 1 + sizeof bltGot);
+    if (memcmp(bltGot, &bltSet[2], sizeof bltGot) != 0) {
+        printf("i2c_test: register read %02X %02X %02X %02X %02X\n",
+               bltGot[0], bltGot[1], bltGot[2], bltGot[3], bltGot[4]);
+        errors++;
+    }
+    errors += Expect("LED read starts", starts[2], 2);
+    errors += Expect("LED read bytes", bytes[2], 4);
+    errors += Expect("LED read value", ledGot, ledSet);
+
+    // Long write: one START, and every byte of the buffer. DDRAM wraps
+    // every 80 characters, so line 1 shows data 240-255 (across the
+    // 255 byte chunk boundary of the buffer) and line 2 data 280-295.
+    errors += Expect("long write starts", starts[3], 1);
+    errors += Expect("long write bytes", bytes[3], 1 + sizeof lcdLong);
+    for (int line = 0; line < 2; line++) {
+        char want[17];
+        memcpy(want, &lcdLong[3 + 240 + 40 * line], 16);
+        want[16] = 0;
+        if (strcmp(SimLcdLine(line), want) != 0) {
+            printf("i2c_test: LCD line %d |%s|, expected |%s|\n",
+                   line + 1, SimLcdLine(line), want);
+            errors++;
+        }
+    }
+
+    if (!requeued) {
+        printf("i2c_test: transfers requested again did not complete\n");
+        errors++;
+    } else
+        errors += Expect("requested again bytes", requeuedBytes,
+                         2 * bytes[3] + 2 * bytes[0] + bytes[2]);
+
+    printf("i2c_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
@@ -0,0 +1,108 @@
+// I2C_Timing() regression test
+//
+// TIMINGR values for each core clock the firmware runs at and each bus
+// mode are decoded as RM0438 describes, and checked against the
+// I2C-bus specification: SCL low and high periods, data setup (SCLDEL)
+// and hold (SDADEL), and an SCL frequency that never exceeds the one
+// requested, even with instant edges and the fastest filters. Requests
+// that no setting can meet must return 0.
+#include <stdio.h>
+#include <stdint.h>
+#include "sim.h"
+#include "i2c.h"
+
+// Specification limits (ns): tLOW, tHIGH and tSU;DAT minimums, tr and
+// tf maximums
+typedef struct {
+    uint32_t hz;
+    const char *name;
+    uint32_t lowMin, highMin, suDatMin, riseMax, fallMax;
+} Mode_t;
+
+static const Mode_t modes[] = {
+    {I2C_STANDARD,  "100 kHz", 4700, 4000, 250, 1000, 300},
+    {I2C_FAST,      "400 kHz", 1300,  600, 100,  300, 300},
+    {I2C_FAST_PLUS, "1 MHz",    500,  260,  50,  120, 120},
+};
+
+static const uint32_t clocks[] = {4000000, 16000000, 55000000, 110000000};
+
+#define AF_MIN 50   // Analog filter delay (ns), least
+
+#define FIELD(t, f) (((t) & I2C_TIMINGR_##f) >> I2C_TIMINGR_##f##_Pos)
+
+static int errors = 0;
+
+static void Fail(uint32_t clock, const Mode_t *m, const char *what,
+                 uint64_t got, uint64_t limit) {
+    printf("i2c_timing_test: %lu MHz, %s: %s %llu ps, limit %llu ps\n",
+           (unsigned long)(clock / 1000000), m->name, what,
+           (unsigned long long)got, (unsigned long long)limit);
+    errors++;
+}
+
+static void Check(uint32_t clock, const Mode_t *m) {
+    uint32_t timing = I2C_Timing(clock, m->hz);
+    if (timing == 0) {
+        printf("i2c_timing_test: %lu MHz, %s: no timing\n",
+               (unsigned long)(clock / 1000000), m->name);
+        errors++;
+        return;
+    }
+
+    // Picoseconds
+    uint64_t clk = 1000000000000ULL / clock;
+    uint64_t presc = (FIELD(timing, PRESC) + 1) * clk;
+    uint64_t scll = (FIELD(timing, SCLL) + 1) * presc;
+    uint64_t sclh = (FIELD(timing, SCLH) + 1) * presc;
+    uint64_t scldel = (FIELD(timing, SCLDEL) + 1) * presc;
+    uint64_t sdadel = FIELD(timing, SDADEL) * presc;
+
+    if (scll < m->lowMin * 1000ULL)
+        Fail(clock, m, "tLOW", scll, m->lowMin * 1000ULL);
+    if (sclh < m->highMin * 1000ULL)
+        Fail(clock, m, "tHIGH", sclh, m->highMin * 1000ULL);
+
+    // Data setup: tSCLDEL >= tr + tSU;DAT
+    uint64_t setup = (m->riseMax + m->suDatMin) * 1000ULL;
+    if (scldel < setup)
+        Fail(clock, m, "tSCLDEL", scldel, setup);
+
+    // Data hold: tSDADEL >= tf - tAF(min) - 3 tI2CCLK
+    int64_t holdMin = (int64_t)(m->fallMax - AF_MIN) * 1000 - 3 * (int64_t)clk;
+    if ((int64_t)sdadel < holdMin)
+        Fail(clock, m, "tSDADEL", sdadel, holdMin);
+
+    // Fastest SCL: instant edges, and each edge synchronized after the
+    // shortest filter delay and 2 kernel clocks
+    uint64_t period = scll + sclh + 2 * (AF_MIN * 1000ULL + 2 * clk);
+    uint64_t wanted = 1000000000000ULL / m->hz;
+    if (period < wanted)
+        Fail(clock, m, "SCL period", period, wanted);
+}
+
+int main(void) {
+    for (unsigned c = 0; c < sizeof clocks / sizeof clocks[0]; c++)
+        for (unsigned i = 0; i < sizeof modes / sizeof modes[0]; i++)
+            Check(clocks[c], &modes[i]);
+
+    // Nothing fits: faster than Fast-mode Plus, a period too long for
+    // the largest prescaler and SCL counts, or no clock at all
+    static const struct {uint32_t clock, hz;} none[] = {
+        {110000000, 1100000}, {4000000, 2000000},
+        {110000000, 1000}, {55000000, 1000},
+        {0, I2C_STANDARD}, {16000000, 0},
+    };
+    for (unsigned i = 0; i < sizeof none / sizeof none[0]; i++) {
+        uint32_t timing = I2C_Timing(none[i].clock, none[i].hz);
+        if (timing != 0) {
+            printf("i2c_timing_test: %lu Hz at %lu Hz clock gave %08lX,"
+                   " expected 0\n", (unsigned long)none[i].hz,
+                   (unsigned long)none[i].clock, (unsigned long)timing);
+            errors++;
+        }
+    }
+
+    printf("i2c_timing_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
@@ -0,0 +1,112 @@
+// Button debounce regression test
+//
+// A GPIOX button bounces on press and on release, is held past its
+// long-press time, and later glitches for a moment. Press, release and
+// held must each be reported once, and a change only after 4 samples
+// in a row have agreed; the glitch must not be reported at all.
+#include <stdio.h>
+#include "sim.h"
+#include "systick.h"
+#include "gpio.h"
+#include "input.h"
+
+#define RUN_MS  2000
+#define BUTTON  (1 << 8)   // GPIOX bit of button 0
+#define LONG_MS 500
+#define MAX_LOG 16
+
+// Button level from a time on, bouncing around each change
+typedef struct {
+    Time_t ms;
+    int    down;
+} Level_t;
+
+static const Level_t script[] = {
+    {100, 1}, {104, 0}, {106, 1},             // Press, bounce seen by a sample
+    {1000, 0}, {1001, 1}, {1003, 0}, {1009, 1}, {1012, 0},  // Release
+    {1500, 1}, {1502, 0},                     // Glitch, shorter than a sample
+};
+#define STEPS (int)(sizeof script / sizeof script[0])
+
+// The last level changes before each event, and the events expected
+#define PRESS_SETTLED   106
+#define RELEASE_SETTLED 1012
+
+typedef struct {
+    Time_t   ms;
+    uint16_t pressed, released, held;
+} Logged_t;
+
+static Logged_t logged[MAX_LOG];
+static int loggedN = 0;
+
+static int Firmware(void) {
+    StartSysTick();
+    InputLongPress(BUTTON, LONG_MS);
+
+    int step = 0;
+    while (1) {
+        Time_t now = TimeNow();
+        for (; step < STEPS && script[step].ms <= now; step++)
+            GPIOX->IDR = script[step].down ? BUTTON : 0;
+
+        InputUpdate();
+        InputEvents_t e = InputRead();
+        if ((e.pressed | e.released | e.held) && loggedN < MAX_LOG)
+            logged[loggedN++] = (Logged_t){now, e.pressed, e.released, e.held};
+
+        WakeAt(now + 1);  // Follow the script every millisecond
+        WaitForEvent();
+    }
+    return 0;
+}
+
+// The one logged event of a kind, at least 3 sample intervals after the
+// level settled (4 samples, the first at the change) and no later than 4
+static int Expect(const char *what, int kind, Time_t settled, Time_t *at) {
+    int found = 0;
+    for (int i = 0; i < loggedN; i++) {
+        uint16_t bits = kind == 0 ? logged[i].pressed :
+                        kind == 1 ? logged[i].released : logged[i].held;
+        if (bits & ~BUTTON)
+            printf("input_test: %s of other bits %04X\n", what, bits);
+        if (bits & BUTTON) {
+            *at = logged[i].ms;
+            found++;
+        }
+    }
+    if (found != 1) {
+        printf("input_test: %s reported %d times, expected once\n", what, found);
+        return 1;
+    }
+    if (settled && (*at < settled + 3 * INPUT_SAMPLE_MS ||
+                    *at > settled + 4 * INPUT_SAMPLE_MS)) {
+        printf("input_test: %s at %u ms, expected %u to %u ms\n", what, *at,
+               settled + 3 * INPUT_SAMPLE_MS, settled + 4 * INPUT_SAMPLE_MS);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    int errors = 0;
+    Time_t pressAt = 0, releaseAt = 0, heldAt = 0;
+
+    SimRun(Firmware, RUN_MS);
+
+    errors += Expect("press", 0, PRESS_SETTLED, &pressAt);
+    errors += Expect("release", 1, RELEASE_SETTLED, &releaseAt);
+    errors += Expect("held", 2, 0, &heldAt);
+    if (heldAt != pressAt + LONG_MS) {
+        printf("input_test: held at %u ms, expected %u ms\n", heldAt,
+               pressAt + LONG_MS);
+        errors++;
+    }
+    if (loggedN != 3) {
+        printf("input_test: %d event reports, expected 3\n", loggedN);
+        errors++;
+    }
+
+    printf("input_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
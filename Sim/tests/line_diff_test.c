@@ -0,0 +1,95 @@
+// LCD line diff regression test
+//
+// Only the characters that differ from what the LCD shows go on the
+// bus: nothing for a line printed again, and a run with its DDRAM
+// address for a change. Changes up to 4 columns apart share a run, as
+// resending the columns between costs less than a new run; changes
+// further apart go in runs of their own. The other line is left alone.
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "systick.h"
+#include "timer.h"
+#include "i2c.h"
+#include "display.h"
+
+#define RUN_MS  2000
+#define SHOW_MS 20  // Passes for the display to queue both lines
+
+// Bus bytes of a run of n characters: address, command word, control
+// byte, then the characters
+#define RUN_BYTES(n) (1 + 2 + 1 + (n))
+
+static int errors = 0;
+static int checked = 0;
+
+// Run the display until the committed frame is on the LCD: the bus
+// stays idle through a pass, so the display has nothing more to queue
+static void Show(void) {
+    DisplayCommit();
+    Time_t start = TimeNow();
+    int idle = 0;  // Passes in a row ending with the bus idle
+    while (TimePassed(start) < SHOW_MS || idle < 2) {
+        TimerService();
+        UpdateDisplay();
+        ServiceI2CRequests();
+        idle = I2C_Idle() ? idle + 1 : 0;
+        WakeAt(TimeNow() + 1);
+        WaitForEvent();
+    }
+}
+
+// Print line 1 and check the runs it took and what the LCD shows
+static void Expect(const char *text, uint64_t runs, uint64_t bytes) {
+    uint64_t b = SimStats.bytes, s = SimStats.starts;
+    DisplayPrint(0, "%s", text);
+    Show();
+    b = SimStats.bytes - b;
+    s = SimStats.starts - s;
+    checked++;
+
+    char want[17];
+    snprintf(want, sizeof want, "%-16s", text);
+    if (s != runs || b != bytes || strcmp(SimLcdLine(0), want) != 0) {
+        printf("line_diff_test: |%s| took %llu runs, %llu bytes, shows |%s|;"
+               " expected %llu runs, %llu bytes\n", text,
+               (unsigned long long)s, (unsigned long long)b, SimLcdLine(0),
+               (unsigned long long)runs, (unsigned long long)bytes);
+        errors++;
+    }
+}
+
+static int Firmware(void) {
+    StartSysTick();
+    DisplayEnable();
+    DisplayPrint(1, "line 2");
+    Show();
+
+    Expect("1P SERVES", 1, RUN_BYTES(9));       // Its blank column resent
+    Expect("1P SERVES", 0, 0);                  // The same again
+    Expect("2P SERVES", 1, RUN_BYTES(1));       // One column
+    Expect("1P SERVED", 2, 2 * RUN_BYTES(1));   // Changes 7 apart
+    Expect("2P S RVES", 1, RUN_BYTES(9));       // ... and 3 apart
+    Expect("1P SERVES  OK", 2, RUN_BYTES(5) + RUN_BYTES(2));  // 6 apart
+    Expect("", 1, RUN_BYTES(13));               // Cleared up to the last
+
+    if (strcmp(SimLcdLine(1), "line 2          ") != 0) {
+        printf("line_diff_test: line 2 |%s|\n", SimLcdLine(1));
+        errors++;
+    }
+
+    while (1)
+        WaitForEvent();
+    return 0;
+}
+
+int main(void) {
+    SimRun(Firmware, RUN_MS);
+
+    if (checked != 7) {
+        printf("line_diff_test: %d of 7 lines checked\n", checked);
+        errors++;
+    }
+    printf("line_diff_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
@@ -0,0 +1,112 @@
+// Marquee scrolling regression test
+//
+// A marquee moves on a column every DISPLAY_SCROLL_MS. With the other
+// line blank, or scrolling too, the display shift moves it for one
+// command a step. With text on the other line, only the marquee's 16
+// visible columns are rewritten and the other line is never touched,
+// also after the display has been shifted.
+#include <stdio.h>
+#include <string.h>
+#include "sim.h"
+#include "systick.h"
+#include "timer.h"
+#include "i2c.h"
+#include "display.h"
+
+#define RUN_MS  30000
+#define SHOW_MS 20  // Passes for the display to queue both lines
+#define STEPS   10  // Marquee steps measured in each case
+
+// Bus bytes of a shift step (address, command word), and of a run of
+// n characters (address, command word, control byte, characters)
+#define SHIFT_BYTES   (1 + 2)
+#define RUN_BYTES(n)  (1 + 2 + 1 + (n))
+
+static const char marquee[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcd";
+static const char other[]   = "zyxwvutsrqponmlk";
+
+static int errors = 0;
+static int cases = 0;
+
+static void Run(Time_t until) {
+    int idle = 0;  // Passes in a row ending with the bus idle
+    while ((int32_t)(TimeNow() - until) < 0 || idle < 2) {
+        TimerService();
+        UpdateDisplay();
+        ServiceI2CRequests();
+        idle = I2C_Idle() ? idle + 1 : 0;
+        WakeAt(TimeNow() + 1);
+        WaitForEvent();
+    }
+}
+
+// Commit and run the display until the frame is on the LCD
+static void Show(void) {
+    DisplayCommit();
+    Run(TimeNow() + SHOW_MS);
+}
+
+static void ExpectLine(const char *name, int line, const char *text) {
+    char want[17];
+    snprintf(want, sizeof want, "%-16.16s", text);
+    if (strcmp(SimLcdLine(line), want) != 0) {
+        printf("scroll_test: %s: LCD line %d |%s|, expected |%s|\n",
+               name, line + 1, SimLcdLine(line), want);
+        errors++;
+    }
+}
+
+// Show a frame, let it scroll STEPS times, and check the bytes each
+// step took and where each line has got to
+static void Expect(const char *name, const char *line1, const char *line2,
+                   uint64_t stepBytes) {
+    // Start from a blank frame, so the marquees start over
+    DisplayPrint(0, "");
+    DisplayPrint(1, "");
+    Show();
+
+    Time_t start = TimeNow();
+    DisplayMarquee(0, "%s", line1);
+    DisplayMarquee(1, "%s", line2);
+    Show();
+    uint64_t b = SimStats.bytes, s = SimStats.starts;
+    Run(start + STEPS * DISPLAY_SCROLL_MS + DISPLAY_SCROLL_MS / 2);
+    b = SimStats.bytes - b;
+    s = SimStats.starts - s;
+    cases++;
+
+    if (b != STEPS * stepBytes || s != STEPS) {
+        printf("scroll_test: %s: %d steps took %llu bytes, %llu transfers;"
+               " expected %llu bytes, %d transfers\n", name, STEPS,
+               (unsigned long long)b, (unsigned long long)s,
+               (unsigned long long)(STEPS * stepBytes), STEPS);
+        errors++;
+    }
+    ExpectLine(name, 0, strlen(line1) > 16 ? line1 + STEPS : line1);
+    ExpectLine(name, 1, strlen(line2) > 16 ? line2 + STEPS : line2);
+}
+
+static int Firmware(void) {
+    StartSysTick();
+    DisplayEnable();
+
+    Expect("beside text", marquee, other, RUN_BYTES(16));
+    Expect("beside blank", marquee, "", SHIFT_BYTES);
+    Expect("both scrolling", marquee, marquee + 1, SHIFT_BYTES);
+    Expect("beside text, shifted", marquee, other, RUN_BYTES(16));
+
+    while (1)
+        WaitForEvent();
+    return 0;
+}
+
+int main(void) {
+    SimRun(Firmware, RUN_MS);
+
+    if (cases != 4) {
+        printf("scroll_test: %d of 4 cases run\n", cases);
+        errors++;
+    }
+    printf("scroll_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
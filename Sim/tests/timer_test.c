@@ -0,0 +1,80 @@
+// Timer wheel regression test
+//
+// A timer with a 64 ms period is re-filed into the level 0 slot that is
+// being expired, and so is a one-shot started for 64 ms from a callback
+// of that slot. Each must wait a whole turn of the wheel, not fire again
+// in the same millisecond.
+#include <stdio.h>
+#include "sim.h"
+#include "systick.h"
+#include "timer.h"
+
+#define RUN_MS  1000
+#define PERIOD  64
+#define MAX_LOG 32
+
+static void Periodic(Timer_t *t);
+static void OneShot(Timer_t *t);
+
+static Timer_t periodic = TIMER(Periodic);
+static Timer_t oneShot  = TIMER(OneShot);
+
+// Times at which the callbacks ran
+static Time_t periodicAt[MAX_LOG];
+static int    periodicN = 0;
+static Time_t oneShotAt[MAX_LOG];
+static int    oneShotN = 0;
+
+static void Periodic(Timer_t *t) {
+    (void)t;
+    if (periodicN < MAX_LOG)
+        periodicAt[periodicN++] = TimeNow();
+    if (periodicN == 1)
+        TimerStart(&oneShot, PERIOD, 0);  // Same slot as the one expiring
+}
+
+static void OneShot(Timer_t *t) {
+    (void)t;
+    if (oneShotN < MAX_LOG)
+        oneShotAt[oneShotN++] = TimeNow();
+}
+
+static int Firmware(void) {
+    StartSysTick();
+    TimerStart(&periodic, PERIOD, PERIOD);
+    while (1) {
+        TimerService();
+        WaitForEvent();
+    }
+    return 0;
+}
+
+int main(void) {
+    int errors = 0;
+
+    SimRun(Firmware, RUN_MS);
+
+    // Every period once, at the period
+    int expected = (RUN_MS - 1) / PERIOD;
+    if (periodicN != expected) {
+        printf("timer_test: %d periodic expiries, expected %d\n", periodicN, expected);
+        errors++;
+    }
+    for (int i = 0; i < periodicN; i++)
+        if (periodicAt[i] != (Time_t)(i + 1) * PERIOD) {
+            printf("timer_test: periodic expiry %d at %u ms, expected %u ms\n",
+                   i + 1, periodicAt[i], (i + 1) * PERIOD);
+            errors++;
+        }
+
+    // Started at the first periodic expiry, one period later
+    if (oneShotN != 1 || oneShotAt[0] != 2 * PERIOD) {
+        printf("timer_test: one-shot expired %d times, first at %u ms,"
+               " expected once at %u ms\n", oneShotN, oneShotN ? oneShotAt[0] : 0,
+               2 * PERIOD);
+        errors++;
+    }
+
+    printf("timer_test: %s\n", errors ? "FAILED" : "ok");
+    return errors != 0;
+}
@@ -1,10 +1,14 @@
 // Alarm system app
-#include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include "alarm.h"
 #include "systick.h"
+#include "timer.h"
+#include "event.h"
+#include "sched.h"
 #include "gpio.h"
 #include "display.h"   //  Added display support
+#include "log.h"
 
 // --------------------------------------------------------
 // GPIO pins
@@ -28,16 +32,40 @@ static enum {DISARMED, ARMED, TRIGGERED} state;
 #define DISARM_TIME 3000     // 3 seconds or more to disarm
 #define ARM_TIME 2000        // Less than 2 seconds to arm
 
+#define PRESS_MIN 50         // Shorter presses are contact bounce
+
+// Backlight: slow pulse when armed, fast when triggered
+#define ARMED_PULSE   2000   // ms per pulse
+#define TRIGGER_PULSE 500
+#define DISARM_FADE   500    // ms back to white
+#define DIM_YELLOW ((Color_t)0x282800)
+#define DIM_RED    ((Color_t)0x280000)
+
+// State icons next to the LCD text (5x8, top row first)
+static const uint8_t lockGlyph[8] = {0x0E, 0x11, 0x11, 0x1F, 0x1B, 0x1B, 0x1F, 0x00};
+static const uint8_t bellGlyph[8] = {0x04, 0x0E, 0x0E, 0x0E, 0x1F, 0x00, 0x04, 0x00};
+
 // --------------------------------------------------------
 // Variables
 // --------------------------------------------------------
 static Time_t pressTime = 0;      // Time button was pressed
-static Time_t pressDur  = 0;      // Duration button was held
-static bool pressed      = false; // Button short press flag
-static Time_t lastToggle = 0;     // Time for LED blinking
 static bool greenOn      = true;  // Toggle state for LEDs
-static bool motion       = false; // Motion detection flag
-static bool buttonHeld   = false; // Long-press flag
+
+// Events from the interrupt callbacks, in the order they happened
+enum {EV_NONE, EV_MOTION, EV_PRESS, EV_RELEASE};
+static EventQueue_t events = EVENT_QUEUE;
+
+// --------------------------------------------------------
+// Timers
+// --------------------------------------------------------
+// Expiries run the alarm task
+static void WakeAlarm(Timer_t *t) {
+    (void)t;
+    SchedSignal(Task_Alarm);
+}
+
+static Timer_t blinkTimer = TIMER(WakeAlarm);  // Blue/green LED blinking
+static Timer_t holdTimer  = TIMER(WakeAlarm);  // Long press, started on press
 
 // --------------------------------------------------------
 // Callback function prototypes
@@ -80,23 +108,71 @@ void Init_Alarm(void) {
     GPIO_Callback(Button, CallbackButtonPress, RISE);
     GPIO_Callback(Button, CallbackButtonRelease, FALL);
 
-    // Enable system tick timer
-    StartSysTick();
-    lastToggle = TimeNow();
-
     // Set initial state
     state = DISARMED;
 
     //  Initialize display
     DisplayEnable();
+    DisplayDrawFor(DISPLAY_ALARM);
     DisplayColor(WHITE);
     DisplayPrint(0, "DISARMED");
+    DisplayCommit();
 }
 
 // --------------------------------------------------------
 // Task (state machine)
 // --------------------------------------------------------
+static void Step(const Event_t *e, bool longPress);
+
 void Task_Alarm(void) {
+    DisplayDrawFor(DISPLAY_ALARM);
+    bool longPress = TimerFired(&holdTimer);
+    int entered = state;
+
+    // Run the state machine once for each event in order, or once
+    // without one for the timers
+    Event_t e;
+    if (!EventPop(&events, &e))
+        e.type = EV_NONE;
+    do {
+        Step(&e, longPress);
+        longPress = false;  // Seen by the first step only
+    } while (EventPop(&events, &e));
+
+    // The alarm takes over the display while armed, and gives it back
+    // to the game once disarmed
+    DisplayClaim(DISPLAY_ALARM, state != DISARMED);
+    DisplayCommit();  // Only the state reached shows
+
+    // A new state sets its outputs on the next run, don't sleep first
+    if (state != entered)
+        SchedSignal(Task_Alarm);
+}
+
+static void Step(const Event_t *e, bool longPress) {
+    bool pressed = false;  // Button short press
+    bool motion  = false;  // Motion detected
+    Time_t pressDur = 0;   // Duration button was held
+
+    switch (e->type) {
+    case EV_MOTION:
+        motion = true;
+        break;
+    case EV_PRESS:
+        // Long press counts from the press, not from when it is seen
+        pressTime = e->time;
+        Time_t held = TimePassed(pressTime);
+        TimerStart(&holdTimer, held < DISARM_TIME ? DISARM_TIME - held : 0, 0);
+        break;
+    case EV_RELEASE:
+        pressDur = e->time - pressTime;
+        if (pressDur >= PRESS_MIN) {
+            pressed = true;
+            TimerStop(&holdTimer);
+        }
+        break;
+    }
+
     switch (state) {
 
     // ----------------------------------------------------
@@ -110,15 +186,12 @@ void Task_Alarm(void) {
 
         if (pressed && pressDur <= ARM_TIME) {
             state = ARMED;
-            DisplayColor(YELLOW);             // Update display
-            DisplayPrint(0, "ARMED");
-            printf("ARMED at time %u\n", TimeNow());
-            pressed = false;
-            pressDur = 0;
+            DisplayPulse(YELLOW, DIM_YELLOW, ARMED_PULSE, BLEND_GAMMA);
+            DisplayPrint(0, "ARMED %c", DisplayGlyph(lockGlyph, '*'));
+            LOG("ARMED at time %u", TimeNow());
+            TimerStart(&blinkTimer, 0, BLINK_PERIOD);
         }
 
-        pressed = false;
-        pressDur = 0;
         break;
 
     // ----------------------------------------------------
@@ -128,7 +201,7 @@ void Task_Alarm(void) {
         GPIO_Output(Buzzer, LOW);
 
         // Blink blue/green LEDs alternately
-        if (TimePassed(lastToggle) >= BLINK_PERIOD) {
+        if (TimerFired(&blinkTimer)) {
             GPIO_Output(RedLED, LOW);
             if (greenOn) {
                 GPIO_Output(GreenLED, LOW);
@@ -138,30 +211,26 @@ void Task_Alarm(void) {
                 GPIO_Output(GreenLED, HIGH);
             }
             greenOn = !greenOn;
-            lastToggle = TimeNow();
         }
 
         // Long press → disarm
-        if (buttonHeld && TimePassed(pressTime) >= DISARM_TIME) {
+        if (longPress) {
             state = DISARMED;
-            DisplayColor(WHITE);              //  Update display
+            DisplayFade(WHITE, DISARM_FADE, BLEND_GAMMA);
             DisplayPrint(0, "DISARMED");
-            printf("DISARMED at time %u\n", TimeNow());
-            pressed = false;
-            buttonHeld = false;
-            pressDur = 0;
+            LOG("DISARMED at time %u", TimeNow());
+            TimerStop(&blinkTimer);
         }
 
         // Motion → trigger alarm
         if (motion) {
             state = TRIGGERED;
-            DisplayColor(RED);                //  Update display
-            DisplayPrint(0, "TRIGGERED");
-            motion = false;
+            DisplayPulse(RED, DIM_RED, TRIGGER_PULSE, BLEND_GAMMA);
+            DisplayMarquee(0, "TRIGGERED %c  MOTION AT %.1u S",
+                           DisplayGlyph(bellGlyph, '!'), e->time / 100);
+            TimerStop(&blinkTimer);
         }
 
-        pressed = false;
-        pressDur = 0;
         break;
 
     // ----------------------------------------------------
@@ -176,27 +245,20 @@ void Task_Alarm(void) {
         // Short press → re-arm
         if (pressed && pressDur <= ARM_TIME) {
             state = ARMED;
-            DisplayColor(YELLOW);             //  Update display
-            DisplayPrint(0, "ARMED");
-            printf("ARMED at time %u\n", TimeNow());
-            pressed = false;
-            pressDur = 0;
-            buttonHeld = false;
+            DisplayPulse(YELLOW, DIM_YELLOW, ARMED_PULSE, BLEND_GAMMA);
+            DisplayPrint(0, "ARMED %c", DisplayGlyph(lockGlyph, '*'));
+            LOG("ARMED at time %u", TimeNow());
+            TimerStart(&blinkTimer, 0, BLINK_PERIOD);
         }
 
         // Long press → disarm
-        if (buttonHeld && TimePassed(pressTime) >= DISARM_TIME) {
+        if (longPress) {
             state = DISARMED;
-            DisplayColor(WHITE);              //  Update display
+            DisplayFade(WHITE, DISARM_FADE, BLEND_GAMMA);
             DisplayPrint(0, "DISARMED");
-            printf("DISARMED at time %u\n", TimeNow());
-            pressed = false;
-            pressDur = 0;
-            buttonHeld = false;
+            LOG("DISARMED at time %u", TimeNow());
         }
 
-        pressed = false;
-        pressDur = 0;
         break;
     }
 }
@@ -204,19 +266,19 @@ void Task_Alarm(void) {
 // --------------------------------------------------------
 // Interrupt callbacks
 // --------------------------------------------------------
+// All at EXTI priority 0, so they never interrupt one another and
+// together are the single producer of the event queue
 void CallbackMotionDetect(void) {
-    motion = true;  // Motion detected
+    EventPush(&events, EV_MOTION, 0);
+    SchedSignal(Task_Alarm);
 }
 
 void CallbackButtonPress(void) {
-    pressTime = TimeNow();
-    buttonHeld = true;
+    EventPush(&events, EV_PRESS, 0);
+    SchedSignal(Task_Alarm);
 }
 
 void CallbackButtonRelease(void) {
-    pressDur = TimePassed(pressTime);
-    if (pressDur >= 50) {
-        pressed = true;
-        buttonHeld = false;
-    }
+    EventPush(&events, EV_RELEASE, 0);
+    SchedSignal(Task_Alarm);
 }
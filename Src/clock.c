@@ -0,0 +1,117 @@
+// System clock configuration
+
+#include "clock.h"
+#include "systick.h"
+#include "i2c.h"
+#include "log.h"
+
+#define MSI_HZ 4000000    // MSI range 6, the reset default
+#define PLL_HZ 110000000  // MSI / PLLM * PLLN / PLLR
+#define PLL_N  55
+
+static ClockProfile_t profile = CLOCK_LOW_POWER;
+
+// --------------------------------------------------------
+// Ready flags
+// --------------------------------------------------------
+static bool VoltageReady(void) { return !(PWR->SR2 & PWR_SR2_VOSF); }
+static bool PllLocked(void)    { return RCC->CR & RCC_CR_PLLRDY; }
+static bool OnPll(void)        { return (RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS; }
+static bool OnMsi(void)        { return (RCC->CFGR & RCC_CFGR_SWS) == 0; }
+
+// Polls a ready flag, false if it is not up within CLOCK_TIMEOUT tries
+static bool WaitFor(bool (*ready)(void)) {
+    for (uint32_t n = 0; n < CLOCK_TIMEOUT; n++)
+        if (ready())
+            return true;
+    return false;
+}
+
+// Set flash wait states, which must have taken effect before HCLK rises
+static bool SetLatency(uint32_t ws) {
+    FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | ws;
+    return (FLASH->ACR & FLASH_ACR_LATENCY) == ws;
+}
+
+// Select the regulator range: 0 up to 110 MHz, 2 up to 26 MHz
+static bool SetVoltage(uint32_t vos) {
+    RCC->APB1ENR1 |= RCC_APB1ENR1_PWREN;
+    PWR->CR1 = (PWR->CR1 & ~PWR_CR1_VOS) | vos;
+    return WaitFor(VoltageReady);
+}
+
+// Everything timed by the core clock follows it
+static void ClockChanged(uint32_t hz) {
+    SystemCoreClock = hz;
+    RetuneSysTick();
+    I2C_Retime(LeafyI2C);
+}
+
+// --------------------------------------------------------
+// Profiles
+// --------------------------------------------------------
+// Down to the MSI first, then the PLL, wait states and voltage
+static bool LowPower(void) {
+    RCC->CFGR &= ~(RCC_CFGR_SW | RCC_CFGR_HPRE);
+    bool ok = WaitFor(OnMsi);
+    ClockChanged(MSI_HZ);
+
+    RCC->CR &= ~RCC_CR_PLLON;
+    ok = SetLatency(FLASH_ACR_LATENCY_0WS) && ok;
+    ok = SetVoltage(PWR_CR1_VOS_1) && ok;
+    profile = CLOCK_LOW_POWER;
+    return ok;
+}
+
+// Voltage and wait states first, then the PLL. HCLK goes through a
+// 1 us step at half speed so that the current drawn rises gradually.
+static bool Performance(void) {
+    if (!SetVoltage(0) || !SetLatency(FLASH_ACR_LATENCY_5WS)) {
+        LOG("clock: voltage range 0 not reached");
+        return false;
+    }
+
+    RCC->CR &= ~RCC_CR_PLLON;
+    RCC->PLLCFGR = RCC_PLLCFGR_PLLSRC_0              // MSI, divided by 1
+                 | PLL_N << RCC_PLLCFGR_PLLN_Pos     // VCO 220 MHz
+                 | RCC_PLLCFGR_PLLREN;               // R output / 2
+    RCC->CR |= RCC_CR_PLLON;
+    if (!WaitFor(PllLocked)) {
+        LOG("clock: PLL did not lock");
+        return false;
+    }
+
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_HPRE) | RCC_CFGR_HPRE_3;  // HCLK / 2
+    RCC->CFGR |= RCC_CFGR_SW;
+    if (!WaitFor(OnPll)) {
+        LOG("clock: switch to PLL failed");
+        return false;
+    }
+    ClockChanged(PLL_HZ / 2);
+    for (volatile int i = 0; i < 16; i++)
+        ;  // At least 1 us
+    RCC->CFGR &= ~RCC_CFGR_HPRE;
+    ClockChanged(PLL_HZ);
+
+    profile = CLOCK_PERFORMANCE;
+    return true;
+}
+
+bool ClockSet(ClockProfile_t p) {
+    if (p == profile)
+        return true;
+
+    if (p == CLOCK_PERFORMANCE) {
+        // A transfer under way would have its SCL sped up along with the
+        // kernel clock; slowing down is harmless
+        if (!I2C_Idle())
+            return false;
+        if (Performance())
+            return true;
+    }
+    return LowPower() && p == CLOCK_LOW_POWER;
+}
+
+ClockProfile_t ClockGet(void) {
+    return profile;
+}
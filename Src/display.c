@@ -2,17 +2,18 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
-#include <stdio.h>
 #include <stdarg.h>
 #include "display.h"
 #include "i2c.h"
 #include "systick.h"
+#include "timer.h"
 
 // --------------------------------------------------------
 // Display controller
 // --------------------------------------------------------
 #define ROWS 2   // Number of rows
 #define COLS 16  // Number of columns
+#define DDRAM_COLS 40  // Columns of display memory per line, COLS visible
 
 // Command word
 typedef struct {
@@ -29,95 +30,838 @@ static const DispCmd_t txInit[] = {
     {0x80, 0x06}   // Entry Mode Set: increment, no shift
 };
 
-// Display line
+// Display line update: DDRAM address followed by a run of characters
 typedef struct {
-    DispCmd_t cmd;         // Command word to set display line
+    DispCmd_t cmd;         // Command word to set DDRAM address
     uint8_t   ctrl;        // Last control byte, data bytes to follow
-    uint8_t   text[COLS];  // ASCII text to write to display
-    uint8_t   term;        // NUL terminator
+    uint8_t   text[DDRAM_COLS];  // ASCII text to write to display
 } DispLine_t;
 
-// Select display line and print text
+// DDRAM address of the first column of each line
+static const uint8_t lineAddr[ROWS] = {0x00, 0x40};
+
+// Display shift: shifts both lines left one column, the controller's
+// window wrapping around the DDRAM_COLS columns of each line
+static const DispCmd_t txShift = {0x80, 0x18};
+
+// Unchanged columns worth resending rather than starting a new run
+// (a run costs START, address, command word and control byte)
+#define RUN_GAP 4
+
+// Frames: each app draws into a back frame of its own and
+// DisplayCommit() takes a copy as the next frame, if the app owns the
+// display. UpdateDisplay() moves that to front once the frame before it
+// has gone out completely, so a frame is never changed while it is
+// being sent. Commits in between replace the waiting frame; the display
+// skips them rather than falling behind. The other apps keep drawing
+// into their own frames, and the one taking over the display has its
+// frame committed as it stands.
+
+// Backlight of a frame: a steady color, a fade from the color showing,
+// or a pulse between two colors
+typedef enum {LIGHT_STEADY, LIGHT_FADE, LIGHT_PULSE} Effect_t;
+
+typedef struct {
+    Effect_t effect;
+    Blend_t  blend;
+    Color_t  color;  // Steady color, end of a fade or start of a pulse
+    Color_t  other;  // Other end of a pulse
+    Time_t   ms;     // Fade time or pulse period
+} Light_t;
+
+typedef struct {
+    char    text[ROWS][DDRAM_COLS];  // Columns past COLS only show if scrolled
+    bool    scroll[ROWS];            // Line is a marquee
+    Light_t light;
+} Frame_t;
+
+#define BLANK_LINE "                                        "
+#define BLANK_FRAME {{BLANK_LINE, BLANK_LINE}, {false, false}, \
+                     {LIGHT_STEADY, BLEND_LINEAR, OFF, OFF, 0}}
+
+static Frame_t backs[DISPLAY_APPS] = {BLANK_FRAME, BLANK_FRAME};
+static Frame_t next;                 // Latest commit, waiting for front
+static Frame_t front = BLANK_FRAME;  // Being sent
+static bool drawn[DISPLAY_APPS];     // A back frame changed since its commit
+static bool committed = false;       // next holds a frame
+
+// App drawing now and its back frame, and the apps claiming the display
+static DisplayApp_t drawing = DISPLAY_GAME;
+static Frame_t *back = &backs[DISPLAY_GAME];
+static uint8_t claims = 0;
+static DisplayApp_t owner = DISPLAY_GAME;
+
+// Shadow copy of the controller's DDRAM (cleared to spaces), and the
+// number of columns the display is shifted left by
+static uint8_t shown[ROWS][DDRAM_COLS] = {BLANK_LINE, BLANK_LINE};
+static int shift = 0;
+
+// Transmit buffers, one run of changed characters per line
 // (separate transfers for lines 1 and 2, each read left to right)
 static DispLine_t txLine[ROWS] = {
-    {{0x80, 0x80}, 0x40, {0}, 0x00},  // Line 1 starts at 0x80
-    {{0x80, 0xC0}, 0x40, {0}, 0x00}   // Line 2 starts at 0xC0
+    {{0x80, 0x80}, 0x40, {0}},  // Line 1 starts at 0x80
+    {{0x80, 0xC0}, 0x40, {0}}   // Line 2 starts at 0xC0
 };
 
 static bool updateLine[2] = {false, false};
+static bool updateColor = false;
+
+// Marquees: a line longer than the display moves on a column every
+// DISPLAY_SCROLL_MS. When every other line is blank, the whole line is
+// written once and the display shifts over it, one command byte a
+// step. The shift moves both lines, so with any other text showing the
+// marquee's 16 visible columns are rewritten in place instead, and the
+// other lines stay as they are.
+static int scrollAt[ROWS];                    // Column of text at the left
+static bool shifting = false;                 // Marquees scroll by shift
+static Timer_t scrollTimer = TIMER(NULL);
+static bool scrollDue = false;                // A step is waiting to go
 
 // I2C transfers
 static I2C_Xfer_t DispInit = {&LeafyI2C, 0x7C, (void *)&txInit, 8, 1, 0, NULL};
 static I2C_Xfer_t DispLine[ROWS] = {
-    {&LeafyI2C, 0x7C, (void *)&txLine[0], 19, 1, 0, NULL},
-    {&LeafyI2C, 0x7C, (void *)&txLine[1], 19, 1, 0, NULL}
+    {&LeafyI2C, 0x7C, (void *)&txLine[0], 3, 1, 0, NULL},
+    {&LeafyI2C, 0x7C, (void *)&txLine[1], 3, 1, 0, NULL}
 };
+static I2C_Xfer_t DispShift = {&LeafyI2C, 0x7C, (void *)&txShift, 2, 1, 0, NULL};
 // Enable LCD display
 void DisplayEnable(void) {
+    I2C_Device(&LeafyI2C, 0x7C, I2C_FAST);       // LCD controller
+    I2C_Device(&LeafyI2C, 0x5A, I2C_FAST_PLUS);  // Backlight controller
     I2C_Enable(LeafyI2C);
     I2C_Request(&DispInit);
 }
 
+// --------------------------------------------------------
+// Text formatting
+// --------------------------------------------------------
+// Lines are built in place in the back frame, clipped at DDRAM_COLS and
+// padded with spaces; only a marquee shows the columns past COLS.
+// Nothing is kept outside the caller's stack and line, and nothing goes
+// through the C library's stdio or the heap.
+
+// Field options parsed from a conversion, as in %-5s or %03u
+#define FIELD_LEFT 1  // Pad on the right
+#define FIELD_ZERO 2  // Pad numbers with leading zeros
+
+// Most decimals of a fixed-point number, enough for all 10 digits of a
+// 32-bit value; a larger precision is clamped to it
+#define FIELD_PREC_MAX 10
+
+typedef struct {
+    int flags;
+    int width;  // Minimum columns
+    int prec;   // Digits after the point, or string length; -1 if none
+} Field_t;
+
+static int PutChar(char *text, int col, char c) {
+    if (col < DDRAM_COLS)
+        text[col] = c;
+    return col + 1;
+}
+
+static int PutString(char *text, int col, const char *s) {
+    while (*s)
+        col = PutChar(text, col, *s++);
+    return col;
+}
+
+// Characters s[0..len) padded out to the field width
+static int PutField(char *text, int col, const char *s, int len,
+                    const Field_t *f) {
+    int fill = f->width - len;
+    if (!(f->flags & FIELD_LEFT)) {
+        if ((f->flags & FIELD_ZERO) && *s == '-') {
+            col = PutChar(text, col, '-');  // Sign goes before the zeros
+            s++;
+            len--;
+        }
+        for (; fill > 0; fill--)
+            col = PutChar(text, col, f->flags & FIELD_ZERO ? '0' : ' ');
+    }
+    for (int i = 0; i < len; i++)
+        col = PutChar(text, col, s[i]);
+    for (; fill > 0; fill--)
+        col = PutChar(text, col, ' ');
+    return col;
+}
+
+// Integer in any base up to 16, with a point f->prec digits from the
+// right for fixed-point values (%.2d of 1234 is 12.34)
+static int PutNumber(char *text, int col, uint32_t value, bool negative,
+                     unsigned base, bool upper, const Field_t *f) {
+    const char *digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char buf[FIELD_PREC_MAX + 3];  // Sign, leading zero, point, decimals
+    char *p = buf + sizeof buf;
+    int prec = f->prec < FIELD_PREC_MAX ? f->prec : FIELD_PREC_MAX;
+    int n = 0;
+    do {
+        if (n == prec && n > 0)
+            *--p = '.';
+        *--p = digits[value % base];
+        value /= base;
+        n++;
+    } while (value != 0 || n <= prec);
+    if (negative)
+        *--p = '-';
+    return PutField(text, col, p, buf + sizeof buf - p, f);
+}
+
+static int PutSigned(char *text, int col, int value, const Field_t *f) {
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    return PutNumber(text, col, magnitude, value < 0, 10, false, f);
+}
+
+// Space out the rest of a line
+static void PadLine(char *text, int col) {
+    for (; col < DDRAM_COLS; col++)
+        text[col] = ' ';
+}
+
+// A subset of printf: %d %u %x %X %c %s %%, with the - and 0 flags, a
+// width, and a precision that is the number of decimals for d and u
+// (fixed-point) or the maximum length for s; a NULL string prints as
+// "(null)". Returns the length of the text before clipping.
+static int Format(char *text, const char *fmt, va_list args) {
+    int col = 0;
+    while (*fmt) {
+        char c = *fmt++;
+        if (c != '%') {
+            col = PutChar(text, col, c);
+            continue;
+        }
+
+        Field_t f = {0, 0, -1};
+        for (;; fmt++) {
+            if (*fmt == '-')
+                f.flags |= FIELD_LEFT;
+            else if (*fmt == '0')
+                f.flags |= FIELD_ZERO;
+            else
+                break;
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+            f.width = f.width * 10 + (*fmt++ - '0');
+        if (*fmt == '.') {
+            f.prec = 0;
+            while (*++fmt >= '0' && *fmt <= '9')
+                f.prec = f.prec * 10 + (*fmt - '0');
+        }
+        if (*fmt == '\0')
+            break;
+
+        switch (c = *fmt++) {
+        case 'd':
+            col = PutSigned(text, col, va_arg(args, int), &f);
+            break;
+        case 'u':
+            col = PutNumber(text, col, va_arg(args, unsigned), false, 10,
+                            false, &f);
+            break;
+        case 'x':
+        case 'X':
+            col = PutNumber(text, col, va_arg(args, unsigned), false, 16,
+                            c == 'X', &f);
+            break;
+        case 'c': {
+            char ch = (char)va_arg(args, int);
+            col = PutField(text, col, &ch, 1, &f);
+            break;
+        }
+        case 's': {
+            const char *s = va_arg(args, const char *);
+            if (s == NULL)
+                s = "(null)";
+            int len = 0;
+            while (s[len] && (f.prec < 0 || len < f.prec))
+                len++;
+            col = PutField(text, col, s, len, &f);
+            break;
+        }
+        default:  // %% and anything unknown print as is
+            col = PutChar(text, col, c);
+            break;
+        }
+    }
+    PadLine(text, col);
+    return col;
+}
+
+// Put a line built on the stack into the back frame. Apps redraw on
+// every pass, so the frame only counts as drawn (and a commit only goes
+// to the display) when the line differs from what it holds.
+static void SetLine(int line, const char *text, bool scroll) {
+    bool same = back->scroll[line] == scroll;
+    for (int i = 0; i < DDRAM_COLS && same; i++)
+        same = back->text[line][i] == text[i];
+    if (same)
+        return;
+    for (int i = 0; i < DDRAM_COLS; i++)
+        back->text[line][i] = text[i];
+    back->scroll[line] = scroll;
+    drawn[drawing] = true;
+}
+
 // Print a line of text with optional format specifiers
 void DisplayPrint(const int line, const char *msg, ...) {
+    char text[DDRAM_COLS];
     va_list args;
     va_start(args, msg);
+    Format(text, msg, args);
+    va_end(args);
+    SetLine(line, text, false);
+}
 
-    // Full buffer with formatted text and space pad the remainder
-    int chars = vsnprintf((char *)txLine[line].text, COLS + 1, msg, args);
-    for (int i = chars; i < COLS; i++)
-        txLine[line].text[i] = ' ';
-
-    updateLine[line] = true;
+// Print a line that scrolls if it is longer than the display
+void DisplayMarquee(const int line, const char *msg, ...) {
+    char text[DDRAM_COLS];
+    va_list args;
+    va_start(args, msg);
+    bool scroll = Format(text, msg, args) > COLS;
     va_end(args);
+    SetLine(line, text, scroll);
+}
+
+// Print "<label>a - b" without parsing a format
+void DisplayPrintScore(const int line, const char *label, int a, int b) {
+    static const Field_t plain = {0, 0, -1};
+    char text[DDRAM_COLS];
+    int col = PutString(text, 0, label);
+    col = PutSigned(text, col, a, &plain);
+    col = PutString(text, col, " - ");
+    col = PutSigned(text, col, b, &plain);
+    PadLine(text, col);
+    SetLine(line, text, false);
+}
+
+// Columns of a frame line that go to the display
+static int LineWidth(const Frame_t *f, int line) {
+    return f->scroll[line] ? DDRAM_COLS : COLS;
+}
+
+// Queue the leftmost run of characters that differ from the display,
+// returns false once the line matches what is shown. Column j of the
+// view holds text[(at + j) % DDRAM_COLS], at the DDRAM column shift
+// columns on; a marquee scrolled by the shift is laid out in full.
+static bool SendChanges(int line) {
+    int at = front.scroll[line] ? scrollAt[line] : 0;
+    int width = front.scroll[line] && shifting ? DDRAM_COLS : COLS;
+    uint8_t text[DDRAM_COLS];  // From the left of the view
+    for (int i = 0; i < width; i++)
+        text[i] = front.text[line][(at + i) % DDRAM_COLS];
+    int first = 0;
+
+    while (first < width && text[first] == shown[line][(shift + first) % DDRAM_COLS])
+        first++;
+    if (first == width)
+        return false; // Nothing changed, skip the transfer
+
+    // Extend the run until a gap of unchanged columns makes a new run
+    // cheaper, or it reaches the end of DDRAM (the address counter would
+    // go on to the other line)
+    uint8_t *ddram = &shown[line][(shift + first) % DDRAM_COLS];
+    int last = first, gap = 0;
+    int end = first + DDRAM_COLS - (shift + first) % DDRAM_COLS;
+    for (int i = first + 1; i < width && i < end && gap <= RUN_GAP; i++) {
+        if (text[i] != ddram[i - first]) {
+            last = i;
+            gap = 0;
+        } else
+            gap++;
+    }
+
+    // Set DDRAM address and copy the run, the shadow now reflects it
+    txLine[line].cmd.data = 0x80 | (lineAddr[line] + (shift + first) % DDRAM_COLS);
+    for (int i = first; i <= last; i++)
+        txLine[line].text[i - first] = ddram[i - first] = text[i];
+
+    DispLine[line].size = 3 + (last - first + 1);
+    I2C_Request(&DispLine[line]);
+    return true;
+}
+
+// --------------------------------------------------------
+// Custom characters
+// --------------------------------------------------------
+// The controller has 8 CGRAM slots for 5x8 glyphs, shown by character
+// codes 0-7 and again by 8-15; the latter are used so that text never
+// holds a 0. Glyphs are identified by the address of their pattern and
+// take the least recently used slot that no frame is showing. Slots are
+// uploaded one transfer each, from UpdateDisplay().
+#define GLYPH_SLOTS 8
+#define GLYPH_CODE  8   // Code of slot 0
+
+// Slot upload: CGRAM address followed by the 8 pattern rows
+typedef struct {
+    DispCmd_t cmd;      // Command word to set CGRAM address
+    uint8_t   ctrl;     // Last control byte, data bytes to follow
+    uint8_t   rows[8];
+} DispGlyph_t;
+
+static const uint8_t *slotGlyph[GLYPH_SLOTS];  // Pattern held, NULL if none
+static uint32_t slotUsed[GLYPH_SLOTS];         // useClock at the last use
+static uint32_t useClock = 0;
+static uint8_t  slotStale = 0;  // Slots whose CGRAM is not their pattern yet
+
+static DispGlyph_t txGlyph = {{0x80, 0x40}, 0x40, {0}};
+static I2C_Xfer_t GlyphXfer = {&LeafyI2C, 0x7C, (void *)&txGlyph, 11, 1, 0, NULL};
+
+static uint8_t SlotsIn(const char *text, int len) {
+    uint8_t slots = 0;
+    for (int i = 0; i < len; i++) {
+        uint8_t c = text[i];
+        if ((c & ~(GLYPH_SLOTS - 1)) == GLYPH_CODE)
+            slots |= 1 << (c - GLYPH_CODE);
+    }
+    return slots;
+}
+
+// Slots referenced by a frame or still in display memory, which must
+// keep their pattern
+static uint8_t FrameSlots(const Frame_t *f) {
+    uint8_t slots = 0;
+    for (int i = 0; i < ROWS; i++)
+        slots |= SlotsIn(f->text[i], LineWidth(f, i));
+    return slots;
+}
+
+static uint8_t SlotsShown(void) {
+    uint8_t slots = SlotsIn((const char *)shown, sizeof shown);
+    slots |= FrameSlots(&next) | FrameSlots(&front);
+    for (int a = 0; a < DISPLAY_APPS; a++)
+        slots |= FrameSlots(&backs[a]);
+    return slots;
+}
+
+char DisplayGlyph(const uint8_t pattern[8], char fallback) {
+    int slot = -1;
+    for (int i = 0; i < GLYPH_SLOTS && slot < 0; i++)
+        if (slotGlyph[i] == pattern)
+            slot = i;
+
+    if (slot < 0) {
+        // Replace an empty slot, else the least recently used one
+        uint8_t busy = SlotsShown();
+        for (int i = 0; i < GLYPH_SLOTS; i++) {
+            if (busy & (1 << i))
+                continue;
+            if (slotGlyph[i] == NULL) {
+                slot = i;
+                break;
+            }
+            if (slot < 0 || slotUsed[i] < slotUsed[slot])
+                slot = i;
+        }
+        if (slot < 0)
+            return fallback;  // All on display
+        slotGlyph[slot] = pattern;
+        slotStale |= 1 << slot;
+    }
+    slotUsed[slot] = ++useClock;
+    return GLYPH_CODE + slot;
+}
+
+// Start the next slot upload, if any and the last one is done
+static void SendGlyph(void) {
+    if (GlyphXfer.busy || slotStale == 0)
+        return;
+    int slot = __builtin_ctz(slotStale);
+    slotStale &= ~(1 << slot);
+    txGlyph.cmd.data = 0x40 | slot << 3;
+    for (int i = 0; i < 8; i++)
+        txGlyph.rows[i] = slotGlyph[slot][i];
+    I2C_Request(&GlyphXfer);
+}
+
+// --------------------------------------------------------
+// Meters and big digits
+// --------------------------------------------------------
+#define FULL_BLOCK 0xFF  // Character ROM
+
+// Bar ends with 1-4 columns lit, and a marker in each of the 5 columns
+static const uint8_t barGlyph[4][8] = {
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10},
+    {0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18},
+    {0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C, 0x1C},
+    {0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E, 0x1E}
+};
+static const uint8_t markGlyph[5][8] = {
+    {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10},
+    {0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08, 0x08},
+    {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04},
+    {0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02},
+    {0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01}
+};
+
+void DisplayMeter(const int line, unsigned value, unsigned max, Meter_t style) {
+    const unsigned steps = COLS * 5;  // Pixel columns across the line
+    char text[DDRAM_COLS];
+    for (int i = COLS; i < DDRAM_COLS; i++)
+        text[i] = back->text[line][i];  // Hidden, kept as they are
+    if (value > max)
+        value = max;
+
+    for (int i = 0; i < COLS; i++)
+        text[i] = ' ';
+    if (style == METER_BAR) {
+        unsigned lit = max ? value * steps / max : 0;
+        unsigned cell = lit / 5;
+        for (unsigned i = 0; i < cell; i++)
+            text[i] = FULL_BLOCK;
+        if (lit % 5)
+            text[cell] = DisplayGlyph(barGlyph[lit % 5 - 1], ' ');
+    } else {
+        unsigned at = max ? value * (steps - 1) / max : 0;
+        text[at / 5] = DisplayGlyph(markGlyph[at % 5], '|');
+    }
+    SetLine(line, text, false);
+}
+
+// Digits are 3 cells wide on both lines, built from full blocks and
+// three glyphs: a bar along the top, one along the bottom, and both
+static const uint8_t bigTop[8]    = {0x1F, 0x1F, 0, 0, 0, 0, 0, 0};
+static const uint8_t bigBottom[8] = {0, 0, 0, 0, 0, 0, 0x1F, 0x1F};
+static const uint8_t bigBoth[8]   = {0x1F, 0x1F, 0, 0, 0, 0, 0x1F, 0x1F};
+
+static const char bigDigit[10][ROWS][3] = {
+    {"FTF", "FBF"}, {"TF ", "BFB"}, {"XXF", "FBB"}, {"XXF", "BBF"},
+    {"FBF", "  F"}, {"FXX", "BBF"}, {"FXX", "FBF"}, {"TTF", "  F"},
+    {"FXF", "FBF"}, {"FXF", "BBF"}
+};
+
+static char BigCell(char part) {
+    switch (part) {
+    case 'F': return FULL_BLOCK;
+    case 'T': return DisplayGlyph(bigTop, '~');
+    case 'B': return DisplayGlyph(bigBottom, '_');
+    case 'X': return DisplayGlyph(bigBoth, '=');
+    default:  return ' ';
+    }
+}
+
+void DisplayBigNumber(int col, unsigned value, int digits) {
+    char text[ROWS][DDRAM_COLS];
+    for (int i = 0; i < ROWS; i++)
+        for (int j = 0; j < DDRAM_COLS; j++)
+            text[i][j] = back->text[i][j];
+
+    // Right to left, 4 columns per digit; leading zeros stay blank
+    for (int d = digits - 1; d >= 0; d--, value /= 10) {
+        bool blank = value == 0 && d != digits - 1;
+        for (int i = 0; i < ROWS; i++)
+            for (int j = 0; j < 4; j++) {
+                int c = col + d * 4 + j;
+                if (c >= 0 && c < COLS)
+                    text[i][c] = blank || j == 3 ? ' ' :
+                                 BigCell(bigDigit[value % 10][i][j]);
+            }
+    }
+    for (int i = 0; i < ROWS; i++)
+        SetLine(i, text[i], false);
 }
 
 // --------------------------------------------------------
 // Backlight controller
 // --------------------------------------------------------
+// Register-address auto-increment flag, OR-ed into the first register.
+// The controller steps through RED, GREEN, BLUE on its own; set to 0x80
+// for PCA963x-style parts that need the AI bit.
+#define BLT_AUTO_INC 0x00
+
 typedef struct {
-    uint8_t addr;  // Address byte
-    uint8_t data;  // Data byte
+    uint8_t addr;     // Address of first register (red)
+    uint8_t rgb[3];   // Red, green and blue brightness
 } BltCmd_t;
 
-// Transmit data buffers to set brightness of each LED, all off by default
-static BltCmd_t txRed   = {0x01, 0x00};
-static BltCmd_t txGreen = {0x02, 0x00};
-static BltCmd_t txBlue  = {0x03, 0x00};
+// Transmit data buffer setting all three LEDs in one write
+static BltCmd_t txBlt = {0x01 | BLT_AUTO_INC, {0x00, 0x00, 0x00}};
 
-static bool updateBlt = true;
+static uint32_t sentColor = ~0u;   // Color last sent, none yet
 
-// I2C transfers
-static I2C_Xfer_t BltRed   = {&LeafyI2C, 0x5A, (void *)&txRed,   2, 1, 0, NULL};
-static I2C_Xfer_t BltGreen = {&LeafyI2C, 0x5A, (void *)&txGreen, 2, 1, 0, NULL};
-static I2C_Xfer_t BltBlue  = {&LeafyI2C, 0x5A, (void *)&txBlue,  2, 1, 0, NULL};
+// I2C transfer
+static I2C_Xfer_t BltRGB = {&LeafyI2C, 0x5A, (void *)&txBlt, 4, 1, 0, NULL};
+
+// Effects are stepped on DISPLAY_LIGHT_STEP_MS boundaries. Each step
+// works out the color from the time since the effect started, so steps
+// can be dropped without slowing it down. The next step is taken when
+// the color next changes, but no sooner than DISPLAY_LIGHT_WRITES writes
+// a second allow; while the last write is still queued (the bus is
+// congested) the newest color waits in its place. A pulse rests at each
+// end for 1/PULSE_HOLD of its period, and no steps run meanwhile. A
+// steady color or the end of a fade is never dropped.
+#define LIGHT_WRITE_MS (1000 / DISPLAY_LIGHT_WRITES)
+#define PULSE_HOLD 8
+
+static Timer_t lightTimer = TIMER(NULL);
+static bool   lightDue = false;    // Step to take when the bus is free
+static Time_t lightStart;          // When the front frame's effect began
+static uint32_t lightFrom;         // Color showing then, where fades start
+static Time_t lastWrite;
 
-// Set new backlight color
+static bool SameLight(const Light_t *a, const Light_t *b) {
+    return a->effect == b->effect && a->blend == b->blend &&
+           a->color == b->color && a->other == b->other && a->ms == b->ms;
+}
+
+// Put a light into the back frame, drawn only if it changed
+static void SetLight(Light_t light) {
+    if (SameLight(&back->light, &light))
+        return;
+    back->light = light;
+    drawn[drawing] = true;
+}
+
+// Set new backlight color, sent with the next frame
 void DisplayColor(Color_t color) {
-    txRed.data   = (color >> 16) & 0xFF;
-    txGreen.data = (color >> 8)  & 0xFF;
-    txBlue.data  = (color >> 0)  & 0xFF;
-    updateBlt = true;
+    SetLight((Light_t){LIGHT_STEADY, BLEND_LINEAR, color, color, 0});
+}
+
+void DisplayFade(Color_t color, Time_t ms, Blend_t blend) {
+    if (ms == 0) {
+        DisplayColor(color);
+        return;
+    }
+    SetLight((Light_t){LIGHT_FADE, blend, color, color, ms});
+}
+
+void DisplayPulse(Color_t color, Color_t other, Time_t period, Blend_t blend) {
+    if (period == 0) {
+        DisplayColor(color);
+        return;
+    }
+    SetLight((Light_t){LIGHT_PULSE, blend, color, other, period});
+}
+
+// Integer square root of v < 65536
+static uint32_t Isqrt(uint32_t v) {
+    uint32_t r = 0;
+    for (uint32_t bit = 1u << 7; bit != 0; bit >>= 1)
+        if ((r + bit) * (r + bit) <= v)
+            r += bit;
+    return r;
+}
+
+// Color num/den of the way from a to b. Gamma blending steps evenly in
+// perceived brightness, taken as the square root of the LED level.
+static uint32_t Mix(uint32_t a, uint32_t b, Time_t num, Time_t den,
+                    Blend_t blend) {
+    uint32_t c = 0;
+    for (int s = 0; s < 24; s += 8) {
+        int32_t x = (a >> s) & 0xFF, y = (b >> s) & 0xFF;
+        if (blend == BLEND_GAMMA) {
+            x = Isqrt(x * 255);
+            y = Isqrt(y * 255);
+        }
+        int32_t v = x + (y - x) * (int32_t)num / (int32_t)den;
+        if (blend == BLEND_GAMMA)
+            v = (v * v + 127) / 255;
+        c |= (uint32_t)v << s;
+    }
+    return c;
+}
+
+// Color of an effect t ms in
+static uint32_t LightAt(const Light_t *l, Time_t t) {
+    switch (l->effect) {
+    case LIGHT_FADE:
+        return t >= l->ms ? l->color : Mix(lightFrom, l->color, t, l->ms, l->blend);
+    case LIGHT_PULSE: {
+        // Rest, there, rest, and back once per period
+        Time_t hold = l->ms / PULSE_HOLD, ramp = l->ms / 2 - hold;
+        Time_t at = t % l->ms;
+        if (ramp == 0 || at < hold)
+            return l->color;
+        if ((at -= hold) < ramp)
+            return Mix(l->color, l->other, at, ramp, l->blend);
+        if ((at -= ramp) < hold)
+            return l->other;
+        at -= hold;
+        return Mix(l->other, l->color, at < ramp ? at : ramp, ramp, l->blend);
+    }
+    default:
+        return l->color;
+    }
+}
+
+static void SendColor(uint32_t color) {
+    sentColor = color;
+    txBlt.rgb[0] = (color >> 16) & 0xFF;
+    txBlt.rgb[1] = (color >> 8)  & 0xFF;
+    txBlt.rgb[2] = (color >> 0)  & 0xFF;
+    I2C_Request(&BltRGB);
+    lastWrite = TimeNow();
+}
+
+// Begin the front frame's effect from the color showing now
+static void StartLight(void) {
+    lightFrom = sentColor == ~0u ? OFF : sentColor;
+    lightStart = TimeNow();
+    lightDue = true;
+}
+
+// Time from t to the next step: the first step boundary, after the
+// write budget allows another write, where the color differs from the
+// one showing. A fade steps at its end at the latest, a pulse once a
+// period.
+static Time_t NextLight(const Light_t *l, Time_t t, uint32_t color) {
+    Time_t wait = LIGHT_WRITE_MS - TimePassed(lastWrite);
+    if (TimePassed(lastWrite) >= LIGHT_WRITE_MS)
+        wait = 0;
+    Time_t limit = l->effect == LIGHT_FADE ? l->ms - t : l->ms;
+    Time_t step = DISPLAY_LIGHT_STEP_MS - t % DISPLAY_LIGHT_STEP_MS;
+    for (; step < limit; step += DISPLAY_LIGHT_STEP_MS)
+        if (step >= wait && LightAt(l, t + step) != color)
+            return step;
+    return limit;
+}
+
+static void StepLight(void) {
+    if (TimerFired(&lightTimer))
+        lightDue = true;
+    if (!lightDue || BltRGB.busy)
+        return;
+    lightDue = false;
+
+    const Light_t *l = &front.light;
+    Time_t t = TimePassed(lightStart);
+    bool last = l->effect == LIGHT_STEADY ||
+                (l->effect == LIGHT_FADE && t >= l->ms);
+    uint32_t color = sentColor;
+    if (last || TimePassed(lastWrite) >= LIGHT_WRITE_MS) {
+        color = LightAt(l, t);  // Else over budget, skip this step
+        if (color != sentColor)
+            SendColor(color);
+    }
+
+    if (last) {
+        TimerStop(&lightTimer);
+        TimerFired(&lightTimer);  // Drop an expiry not seen yet
+    } else
+        TimerStart(&lightTimer, NextLight(l, t, color), 0);
 }
 
 // --------------------------------------------------------
 // Automatic background updates
 // --------------------------------------------------------
-// Called from main loop
-void UpdateDisplay(void) {
+void DisplayDrawFor(DisplayApp_t app) {
+    drawing = app;
+    back = &backs[app];
+}
+
+void DisplayClaim(DisplayApp_t app, bool claim) {
+    if (claim)
+        claims |= 1 << app;
+    else
+        claims &= ~(1 << app);
+}
+
+// Hand what the owner of the display has drawn to the driver as the
+// next frame
+void DisplayCommit(void) {
+    if (drawing != owner || !drawn[drawing])
+        return;  // Not on display, or same as the last frame
+    next = *back;
+    committed = true;
+    drawn[drawing] = false;
+}
+
+// Give the display to the highest app claiming it. The apps have run
+// this pass and ended with a commit, so its frame is complete.
+static void SelectOwner(void) {
+    DisplayApp_t app = claims ? 31 - __builtin_clz(claims) : DISPLAY_GAME;
+    if (app == owner)
+        return;
+    owner = app;
+    next = backs[app];
+    committed = true;
+    drawn[app] = false;
+}
+
+// Every run of the front frame and its color are on the display, and
+// so is every glyph the next one may use
+static bool FrameSent(void) {
     for (int i = 0; i < ROWS; i++)
-        if (!DispLine[i].busy && updateLine[i]) {
-            updateLine[i] = false;
-            I2C_Request(&DispLine[i]);
+        if (updateLine[i] || DispLine[i].busy)
+            return false;
+    return !updateColor && !BltRGB.busy && slotStale == 0 && !GlyphXfer.busy;
+}
+
+// A marquee starts over from its first column when its text changes
+static void StartMarquees(void) {
+    bool scrolling = false, restart = false;
+    for (int i = 0; i < ROWS; i++) {
+        if (!next.scroll[i])
+            continue;
+        scrolling = true;
+        bool same = front.scroll[i];
+        for (int j = 0; j < DDRAM_COLS && same; j++)
+            same = next.text[i][j] == front.text[i][j];
+        if (!same) {
+            scrollAt[i] = 0;
+            restart = true;
         }
+    }
 
-    if (!BltBlue.busy && updateBlt) {
-        updateBlt = false;
-        I2C_Request(&BltRed);
-        I2C_Request(&BltGreen);
-        I2C_Request(&BltBlue);
+    if (restart) {
+        // New text stays put for a whole step first
+        TimerStart(&scrollTimer, DISPLAY_SCROLL_MS, DISPLAY_SCROLL_MS);
+        scrollDue = false;
+    } else if (!scrolling && TimerActive(&scrollTimer)) {
+        TimerStop(&scrollTimer);
+        TimerFired(&scrollTimer);  // Drop an expiry not seen yet
+        scrollDue = false;
     }
 }
 
+// The display shift can scroll a frame's marquees if nothing else shows
+static bool OnlyMarquees(const Frame_t *f) {
+    for (int i = 0; i < ROWS; i++)
+        for (int j = 0; j < COLS && !f->scroll[i]; j++)
+            if (f->text[i][j] != ' ')
+                return false;
+    return true;
+}
 
+// Called from main loop
+void UpdateDisplay(void) {
+    SelectOwner();
+    SendGlyph();
+    if (committed && FrameSent()) {
+        StartMarquees();
+        shifting = OnlyMarquees(&next);
+        updateColor = !SameLight(&next.light, &front.light);
+        front = next;
+        committed = false;
+        for (int i = 0; i < ROWS; i++)
+            updateLine[i] = true;
+    }
+
+    // Scroll once the frame is out: shift the display and clear what
+    // moved into view on the blank lines, or rewrite the marquees
+    if (TimerFired(&scrollTimer))
+        scrollDue = true;
+    if (scrollDue && FrameSent() && !DispShift.busy) {
+        scrollDue = false;
+        if (shifting) {
+            shift = (shift + 1) % DDRAM_COLS;
+            I2C_Request(&DispShift);
+        }
+        for (int i = 0; i < ROWS; i++) {
+            if (front.scroll[i])
+                scrollAt[i] = (scrollAt[i] + 1) % DDRAM_COLS;
+            updateLine[i] = front.scroll[i] != shifting;
+        }
+    }
+
+    for (int i = 0; i < ROWS; i++)
+        if (!DispLine[i].busy && updateLine[i])
+            updateLine[i] = SendChanges(i);  // Keep going until all runs sent
 
+    // A new light starts after the lines, and runs on between frames;
+    // colors are only sent when they differ from the last one
+    if (!BltRGB.busy && updateColor) {
+        updateColor = false;
+        StartLight();
+    }
+    StepLight();
+}
@@ -0,0 +1,35 @@
+// Single-producer/single-consumer event queues
+
+#include "event.h"
+
+#if EVENT_QUEUE_SIZE & (EVENT_QUEUE_SIZE - 1)
+#error EVENT_QUEUE_SIZE must be a power of two
+#endif
+
+bool EventPush(EventQueue_t *q, uint8_t type, uint8_t arg) {
+    uint32_t head = q->head;
+    if (head - q->tail == EVENT_QUEUE_SIZE) {
+        q->overflows++;
+        return false;
+    }
+
+    Event_t *e = &q->ring[head & (EVENT_QUEUE_SIZE - 1)];
+    e->time = TimeNow();
+    e->type = type;
+    e->arg = arg;
+    __COMPILER_BARRIER();  // Slot is filled before the consumer can see it
+    q->head = head + 1;
+    return true;
+}
+
+bool EventPop(EventQueue_t *q, Event_t *e) {
+    uint32_t tail = q->tail;
+    if (q->head == tail)
+        return false;
+
+    __COMPILER_BARRIER();  // Read the slot only after seeing head move
+    *e = q->ring[tail & (EVENT_QUEUE_SIZE - 1)];
+    __COMPILER_BARRIER();  // Slot is copied before the producer may reuse it
+    q->tail = tail + 1;
+    return true;
+}
@@ -3,8 +3,10 @@
 #include "game.h"
 #include "gpio.h"
 #include "systick.h"
+#include "timer.h"
+#include "input.h"
+#include "sched.h"
 #include "display.h"
-#include <stdio.h>
 
 // --------------------------------------------------------
 // Constants
@@ -15,6 +17,14 @@
 #define SPEED_FAST 70U
 #define NUM_SPEEDS     3
 #define QUIT_HOLD_TIME 3000U  // 3 seconds to quit
+#define SERVE_DELAY 400U     // Pause after the serve before the ball moves
+#define SCORE_DELAY 100U     // Pause on the score message
+
+// GPIOX buttons (1 = pressed)
+#define P2_BUTTONS    ((1 << 8) | (1 << 9) | (1 << 10))
+#define START_BUTTON  (1 << 11)
+#define SELECT_BUTTON (1 << 12)
+#define P1_BUTTONS    ((1 << 13) | (1 << 14) | (1 << 15))
 
 static bool P1serve = true;
 
@@ -25,12 +35,13 @@ static bool P1serve = true;
 //static const Pin_t SelButton      = {GPIOB, 2};   // Pin PB2  -> Select Button
 
 // State Machine
-static enum {TITLE, SERVE, PLAY, WIN} state;
+// LAUNCH and SCORED hold the display for a moment before play moves
+// on, QUIT waits for Start to be let go of after a quit
+static enum {TITLE, SERVE, LAUNCH, PLAY, SCORED, WIN, QUIT} state;
 
 
 // Module-scope variables
 // --------------------------------------------------------
-static Time_t timeShift;   // Time LED position was last shifted
 static int position = 1;   // Current position of illuminated LED
 static int direction = 0;  // 0 = right, 1 = left
 static int reversed = 0;   // Direction-reversal flag
@@ -41,17 +52,34 @@ static int P2score = 0;
 
 static uint32_t speedTable[NUM_SPEEDS] = { SPEED_SLOW, SPEED_MED, SPEED_FAST };
 
-static bool selectPressed = false; // select button press flag
-
 static bool showingScore = false;
 
+// Timers
+// --------------------------------------------------------
+// Expiries run the game task
+static void WakeGame(Timer_t *t) {
+    (void)t;
+    SchedSignal(Task_Game);
+}
+
+static Timer_t shiftTimer = TIMER(WakeGame);  // LED/ball shift, current speed
+static Timer_t flashTimer = TIMER(WakeGame);  // LED flashing on the WIN screen
+static Timer_t pauseTimer = TIMER(WakeGame);  // LAUNCH and SCORED durations
+
+// Restart LED shifting at the selected speed
+static void StartShifting(void) {
+    TimerStart(&shiftTimer, speedTable[speedIndex], speedTable[speedIndex]);
+}
+
 
 // --------------------------------------------------------
 // Initialization
 // --------------------------------------------------------
 void Init_Game(void) {
     GPIO_PortEnable(GPIOX);   // Enable the I/O expander (LEDs & buttons)
-    timeShift = TimeNow();    // Record current time
+    InputLongPress(START_BUTTON, QUIT_HOLD_TIME);
+    InputNotify(Task_Game);
+    StartShifting();
     position = 0;
     direction = 0;
     reversed = 0;
@@ -61,10 +89,11 @@ void Init_Game(void) {
       state = TITLE;
 
       DisplayEnable();
+	  DisplayDrawFor(DISPLAY_GAME);  // Shown unless the alarm claims the display
 	  DisplayColor(WHITE);
 	  DisplayPrint(0, "PONG");
 	  DisplayPrint(1, "Speed: SLOW");
-
+	  DisplayCommit();
 }
 
 
@@ -73,34 +102,22 @@ void Init_Game(void) {
 // --------------------------------------------------------
 void Task_Game(void) {
 
-	uint16_t inputs;
-
-	static Time_t startHoldTime = 0;
-	static bool startHeld = false;
+	DisplayDrawFor(DISPLAY_GAME);
+	InputEvents_t in = InputRead();  // Consumed in every state
+	int entered = state;
 
 	// Global quit detection (hold Start for 3 seconds)
-	bool currStartState = (GPIO_PortInput(GPIOX) & (1 << 11));  // Active-low
+	bool startHeld = in.state & START_BUTTON;
 
-	if (currStartState && !startHeld) {
-	    // Start button just pressed
-	    startHoldTime = TimeNow();
-	    startHeld = true;
+	if (in.pressed & START_BUTTON) {
 	    GPIO_PortOutput(GPIOX, 0x00);  // Turn off all LEDs immediately
-	} else if (!currStartState) {
-	    // Start button released
-	    startHeld = false;
 	}
 
 	// Check if Start held for 3+ seconds (except in TITLE state)
-	if (state != TITLE && startHeld && TimePassed(startHoldTime) >= QUIT_HOLD_TIME) {
+	if (state != TITLE && state != QUIT && (in.held & START_BUTTON)) {
 	    // LEDs already off from above
 
-	    // Wait for Start button release
-	    while (!(GPIO_PortInput(GPIOX) & (1 << 11))) {
-	        // Busy wait
-	    }
-
-	    // Reset game and return to title
+	    // Reset game, return to title once Start is released
 	    P1score = 0;
 	    P2score = 0;
 	    firstServe = true;
@@ -111,23 +128,19 @@ void Task_Game(void) {
 	    DisplayColor(WHITE);
 	    DisplayPrint(0, "PONG");
 	    DisplayPrint(1, "Speed: SLOW");
-	    GPIO_PortOutput(GPIOX, 1 << position);
-	    timeShift = TimeNow();
+	    TimerStop(&shiftTimer);
+	    TimerStop(&flashTimer);
+	    TimerStop(&pauseTimer);
 
-	    state = TITLE;
-	    startHeld = false;
+	    state = QUIT;
+	    DisplayCommit();
 	    return;
 	}
 
-	// If Start is held but not in quit mode, keep LEDs off (except in TITLE)
-	if (state != TITLE && startHeld) {
-	    GPIO_PortOutput(GPIOX, 0x00);
-	}
-
 	switch (state) {
 		case TITLE:
-		 // Shift LED position every SHIFT_TIME ms
-			if (TimePassed(timeShift) >=  speedTable[speedIndex]) {
+		 // Shift LED position at the selected speed
+			if (TimerFired(&shiftTimer)) {
 
 				if (position == 7)
 					direction = 0;
@@ -139,25 +152,16 @@ void Task_Game(void) {
 				position += direction ? +1 : -1;
 
 				GPIO_PortOutput(GPIOX, (uint16_t)(1 << position));  // Update LEDs
-				timeShift = TimeNow();                              // Reset shift timer
 			}
 
 
 
-			bool currSelectState = (GPIO_PortInput(GPIOX) & (1 << 12));  // Active-low button
-			static bool prevSelectState = false;
-			if (currSelectState && !prevSelectState) {
-			    // Rising edge (press)
-			    selectPressed = true;
-			}
-			prevSelectState = currSelectState;
 			// Handle select button press (speed change)
-			if (selectPressed) {
-				selectPressed = false;
-
+			if (in.pressed & SELECT_BUTTON) {
 
 				// Cycle speed index 0 → 1 → 2 → 0
 				speedIndex = (speedIndex + 1) % NUM_SPEEDS;
+				StartShifting();
 
 				// Update display text for feedback
 				switch (speedIndex) {
@@ -169,20 +173,16 @@ void Task_Game(void) {
 
 
 
-			bool currStartStateTitle = (GPIO_PortInput(GPIOX) & (1 << 11));  // Active-low button
-			static bool prevStartStateTitle = false;
-
-			// Only transition on RISING EDGE (button press), not while held
-			if (currStartStateTitle && !prevStartStateTitle) {
+			// Only transition on a press, not while held
+			if (in.pressed & START_BUTTON) {
+			    TimerStop(&shiftTimer);
 			    state = SERVE;
 			}
-			prevStartStateTitle = currStartStateTitle;
 
 		break;
 
 		case SERVE:
 			static bool serveReady = false;
-			static Time_t serveStart = 0;
 
 			Time_t seed = TimeNow();
 
@@ -195,7 +195,6 @@ void Task_Game(void) {
 				}
 
 				firstServe = false;
-				serveStart = TimeNow();
 				serveReady = true;
 
 
@@ -214,19 +213,15 @@ void Task_Game(void) {
 					P1serve = !P1serve;
 				}
 
-	            serveStart = TimeNow();
 				serveReady = true;
 	        }
 
-			inputs = GPIO_PortInput(GPIOX);
+			bool selectHeld = (in.state & SELECT_BUTTON);
 
 
-			bool selectHeld = (inputs & (1 << 12));
-
-
-			// --- Detect serve button (active-low) ---
-			bool P2press = !(inputs & ((1 << 8) | (1 << 9) | (1 << 10)));
-			bool P1press = !(inputs & ((1 << 13) | (1 << 14) | (1 << 15)));
+			// --- Detect serve button ---
+			bool P2press = (in.pressed & P2_BUTTONS);
+			bool P1press = (in.pressed & P1_BUTTONS);
 
 			if (serveReady) {
 
@@ -247,16 +242,14 @@ void Task_Game(void) {
 
 				 if (selectHeld) {
 					 DisplayColor(RED);
-					 char scoreText[17];
-					 sprintf(scoreText, "SCORE  %d - %d", P1score, P2score);
-					 DisplayPrint(1, scoreText);
+					 DisplayPrintScore(1, "SCORE  ", P1score, P2score);
 
 					 // Show score in binary on LEDs
 					 uint8_t scoreBinary = ((P1score & 0x0F) << 4) | (P2score & 0x0F);
 					 GPIO_PortOutput(GPIOX, scoreBinary);
 				}
 
-				if ((P1serve && !P1press) || (!P1serve && !P2press)) {
+				if ((P1serve && P1press) || (!P1serve && P2press)) {
 					// Start the volley
 
 					direction = P1serve ? 0 : 1;
@@ -266,40 +259,33 @@ void Task_Game(void) {
 
 					serveReady = false;
 
-					timeShift = TimeNow();
-					state = PLAY;
-					msDelay(400);
-
+					TimerStart(&pauseTimer, SERVE_DELAY, 0);
+					state = LAUNCH;
 				}
 
 			}
 		break;
 
-		case PLAY:
-			inputs = GPIO_PortInput(GPIOX);
+		case LAUNCH:
+			// Let the PLAY! message show before the ball moves
+			if (TimerFired(&pauseTimer)) {
+				TimerStart(&shiftTimer, 0, speedTable[speedIndex]);
+				state = PLAY;
+			}
+		break;
 
-			if (TimePassed(timeShift) >= speedTable[speedIndex]) {
+		case PLAY:
+			if (TimerFired(&shiftTimer)) {
 			        // Move ball one step in current direction
 				position += direction ? +1 : -1;
 				GPIO_PortOutput(GPIOX, (uint16_t)(1 << position));
-				timeShift = TimeNow();
+				if (position >= 0 && position <= 7)
+					DisplayMeter(1, position, 7, METER_POSITION);  // Ball on the LCD too
 			}
 
-			static bool prevP1State = true;
-			static bool prevP2State = true;
-
-
-			 // read active-low inputs
-			 bool currP2State = (inputs & ((1 << 8) | (1 << 9) | (1 << 10)));
-			 bool currP1State = (inputs & ((1 << 13) | (1 << 14) | (1 << 15)));
-
-
-			 // detect *edge* — button was just pressed
-			 bool P1return = (currP1State && prevP1State); // went high→low
-			 bool P2return = (currP2State && prevP2State);
-
-			 prevP1State = currP1State;
-			 prevP2State = currP2State;
+			 // A return is a press while the ball is at the player's end
+			 bool P1return = (in.pressed & P1_BUTTONS);
+			 bool P2return = (in.pressed & P2_BUTTONS);
 
 
 			 if (position == 0){
@@ -328,13 +314,9 @@ void Task_Game(void) {
 					DisplayPrint(0, "1P SCORES!");
 
 					 // Check win condition
-					if (P1score >= 11 && (P1score - P2score) >= 2) {
-						state = WIN;
-					} else {
-						state = SERVE;
-					}
-
-					msDelay(100);
+					TimerStop(&shiftTimer);
+					TimerStart(&pauseTimer, SCORE_DELAY, 0);
+					state = SCORED;
 				}
 			}
 
@@ -349,16 +331,34 @@ void Task_Game(void) {
 					DisplayPrint(0, "2P SCORES!");
 
 					// Check win condition
-					if (P2score >= 11 && (P2score - P1score) >= 2) {
-						state = WIN;
-					} else {
-						state = SERVE;
-					}
+					TimerStop(&shiftTimer);
+					TimerStart(&pauseTimer, SCORE_DELAY, 0);
+					state = SCORED;
+				}
+			}
 
-					msDelay(100);
+		break;
+
+		case SCORED:
+			// Hold the score message, then check win condition
+			if (TimerFired(&pauseTimer)) {
+				if ((P1score >= 11 && (P1score - P2score) >= 2) ||
+				    (P2score >= 11 && (P2score - P1score) >= 2)) {
+					TimerStart(&flashTimer, 0, 500);
+					state = WIN;
+				} else {
+					state = SERVE;
 				}
 			}
+		break;
 
+		case QUIT:
+			// LEDs stay off above while Start is held
+			if (!startHeld) {
+				GPIO_PortOutput(GPIOX, 1 << position);
+				StartShifting();
+				state = TITLE;
+			}
 		break;
 
 		case WIN:
@@ -371,24 +371,18 @@ void Task_Game(void) {
 				DisplayPrint(0, "PLAYER 2 WINS!");
 			}
 
-			char finalScore[17];
-			sprintf(finalScore, "Score: %d - %d", P1score, P2score);
-			DisplayPrint(1, finalScore);
+			DisplayPrintScore(1, "Score: ", P1score, P2score);
 
 			// Flash all LEDs
-			static Time_t flashTime = 0;
 			static bool ledsOn = false;
 
-			if (TimePassed(flashTime) >= 500) {
+			if (TimerFired(&flashTimer)) {
 				ledsOn = !ledsOn;
 				GPIO_PortOutput(GPIOX, ledsOn ? 0xFF : 0x00);
-				flashTime = TimeNow();
 			}
 
 			// Wait for Start button press to return to title
-			currStartState = (GPIO_PortInput(GPIOX) & (1 << 11));
-			static bool prevStartStateWin = false;
-			if (currStartState && !prevStartStateWin) {
+			if (in.pressed & START_BUTTON) {
 				// Reset game
 				P1score = 0;
 				P2score = 0;
@@ -404,15 +398,26 @@ void Task_Game(void) {
 				case 2: DisplayPrint(1, "Speed: FAST   "); break;
 				}
 				GPIO_PortOutput(GPIOX, 1 << position);
-				timeShift = TimeNow();
+				TimerStop(&flashTimer);
+				StartShifting();
 
 				state = TITLE;
 			}
-			prevStartStateWin = currStartState;
 		break;
 	}
 
+	// If Start is held but not in quit mode, keep LEDs off (except in TITLE),
+	// whatever the state above has just shown
+	if (state != TITLE && startHeld) {
+	    GPIO_PortOutput(GPIOX, 0x00);
+	}
+
+	// A new state starts on the next run, which must not wait for a timer
+	// or input
+	if (state != entered)
+		SchedSignal(Task_Game);
 
+	DisplayCommit();  // Whatever this run has drawn, as one frame
 }
 
 
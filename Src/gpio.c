@@ -5,11 +5,17 @@
 #include <stddef.h>
 #include "gpio.h"
 #include "i2c.h"
+#include "systick.h"
 
 // --------------------------------------------------------
 // Initialization
 // --------------------------------------------------------
 
+// Set once the I/O expander is enabled, UpdateIOExpanders() idles until then
+static bool ioxEnabled = false;
+
+static void IOX_Init(void);
+
 // Enable the GPIO port peripheral clock for the specified pin
 void GPIO_Enable(Pin_t pin) {
     GPIO_PortEnable(pin.port);
@@ -17,9 +23,13 @@ void GPIO_Enable(Pin_t pin) {
 
 // Enable the GPIO port peripheral clock for the specified GPIO port
 void GPIO_PortEnable(GPIO_TypeDef *port) {
-    if (port == GPIOX)
+    if (port == GPIOX) {
+        I2C_Device(&LeafyI2C, 0x70, I2C_FAST);  // LED expander
+        I2C_Device(&LeafyI2C, 0x72, I2C_FAST);  // Button expander
         I2C_Enable(LeafyI2C);  // Enable I/O Expander (virtual port)
-    else
+        IOX_Init();
+        ioxEnabled = true;
+    } else
         RCC->AHB2ENR |= RCC_AHB2ENR_GPIOAEN << GPIO_PORT_NUM(port);  // Enable real GPIO port clock
 }
 
@@ -140,6 +150,8 @@ void GPIO_IRQHandler(int i) {
         EXTI->FPR1 = (1 << i);
         if (callbacks[i][FALL]) callbacks[i][FALL]();
     }
+
+    WakeNow();  // Let the main loop react
 }
 
 // Dispatch all GPIO IRQs to common handler function
@@ -171,19 +183,100 @@ GPIO_TypeDef IOX_GPIO_Regs = {0xFFFFFFFF, 0, 0, 0, 0, 0, 0, 0, {0, 0}, 0, 0, 0};
 static uint8_t IOX_txData = 0xFF;
 static uint8_t IOX_rxData = 0xFF;
 
-// I2C transfer structures (bus, addr, data, size, stop, busy, next)
-static I2C_Xfer_t IOX_LEDs = {&LeafyI2C, 0x70, &IOX_txData, 1, 1, 0, NULL};
-static I2C_Xfer_t IOX_PBs  = {&LeafyI2C, 0x73, &IOX_rxData, 1, 1, 0, NULL};
+IOX_Stats_t IOX_Stats;
+
+// I2C transfer structures (bus, addr, data, size, stop, busy, next, prio),
+// ahead of display traffic on the bus
+static I2C_Xfer_t IOX_LEDs = {&LeafyI2C, 0x70, &IOX_txData, 1, 1, 0, NULL, I2C_HIGH};
+static I2C_Xfer_t IOX_PBs  = {&LeafyI2C, 0x73, &IOX_rxData, 1, 1, 0, NULL, I2C_HIGH};
+
+#if IOX_INTERRUPTS
+static const Pin_t IOX_IntPin = {GPIOF, 3};  // Pin PF3 <- button expander INT
+
+// The expander pulls INT low when its inputs differ from the last read
+// and lets go once they are read again
+static volatile bool pbChanged = true;  // Read once to begin with
+
+static void CallbackIOXChange(void) {
+    pbChanged = true;
+}
+#endif
+
+static void IOX_Init(void) {
+#if IOX_INTERRUPTS
+    GPIO_Enable(IOX_IntPin);
+    GPIO_Mode(IOX_IntPin, INPUT);
+    GPIO_Config(IOX_IntPin, PP, S0, PU);  // Open-drain output on the expander
+    GPIO_Callback(IOX_IntPin, CallbackIOXChange, FALL);
+#endif
+}
 
 // Update I/O Expander data
 void UpdateIOExpanders(void) {
-    // Copy to/from data buffers with polarity inversion
-    IOX_txData = ~(GPIOX->ODR & 0xFF);  // LEDs in bits 7:0
-    GPIOX->IDR = (~IOX_rxData) << 8;    // PBs in bits 15:8
+    if (!ioxEnabled)
+        return; // No LEDs or buttons in use, nothing to poll
+
+    // Copy from receive buffer with polarity inversion. The apps have
+    // already run this pass, make sure they see a change on the next.
+    uint32_t idr = (~IOX_rxData) << 8;  // PBs in bits 15:8
+    bool changed = idr != GPIOX->IDR;
+    if (changed) {
+        GPIOX->IDR = idr;
+        WakeNow();
+    }
+    Time_t now = TimeNow();
 
-    // Keep requesting transfers to/from I/O expanders
-    if (!IOX_LEDs.busy)
+    // Write the LEDs only when they differ from what was last sent, a
+    // change made while a write is under way goes out after it
+    static int ledsSent = -1;           // Nothing sent yet
+    static Time_t ledsSeen;             // Time of the last call
+    if (ledsSent < 0)
+        ledsSeen = now;
+    Time_t ticks = now - ledsSeen;      // Writes the per-tick update made
+    ledsSeen = now;
+    uint8_t leds = ~(GPIOX->ODR & 0xFF);  // LEDs in bits 7:0
+    if (leds != ledsSent && !IOX_LEDs.busy) {
+        IOX_txData = leds;
+        ledsSent = leds;
         I2C_Request(&IOX_LEDs);
-    if (!IOX_PBs.busy)
+        IOX_Stats.ledWrites++;
+        if (ticks > 0)
+            ticks--;                    // One of them still goes out
+    }
+    IOX_Stats.ledElided += ticks;
+
+#if IOX_INTERRUPTS
+    // Read the buttons on a change, or now and then in case INT is not
+    // connected. INT still being low after a read means an edge arrived
+    // while the previous one was under way; that is read again on the
+    // next tick. A line held low (floating, or a stuck expander) would
+    // keep the bus busy, so after IOX_STUCK_READS such reads in a row
+    // find nothing new only edges and the poll are left.
+    static Time_t lastRead;
+    static int stuckReads = 0;          // Reads on INT low with no change
+    bool intLow = GPIO_Input(IOX_IntPin) == LOW;
+    if (changed || !intLow)
+        stuckReads = 0;
+    bool level = intLow && stuckReads < IOX_STUCK_READS;
+    if (!IOX_PBs.busy && (pbChanged || (level && now != lastRead) ||
+                          TimePassed(lastRead) >= IOX_POLL_MS)) {
+        if (!pbChanged && level)
+            stuckReads++;
+        pbChanged = false;
+        lastRead = now;
         I2C_Request(&IOX_PBs);
+    }
+    if (!IOX_PBs.busy)                  // Else the next pass once it is done
+        WakeAt(lastRead + (level ? 1 : IOX_POLL_MS));
+#else
+    // Keep requesting button reads once per tick however often the
+    // loop runs; they are only seen by polling, come back next tick
+    static Time_t lastPoll = TIME_MAX;
+    if (now != lastPoll) {
+        lastPoll = now;
+        if (!IOX_PBs.busy)
+            I2C_Request(&IOX_PBs);
+    }
+    WakeAt(lastPoll + 1);
+#endif
 }
@@ -1,24 +1,193 @@
-// I2C driver version 3
+// I2C driver version 5
 #include <stddef.h>
-#include <stdio.h>
 #include "i2c.h"
 #include "gpio.h"
+#include "systick.h"
+#include "log.h"
 
 // There is one I2C bus present on the lab platform:
 I2C_Bus_t LeafyI2C = {
     I2C2,       // I2C controller 2
     {GPIOF, 0}, // SDA pin PF0
-    {GPIOF, 1}  // SCL pin PF1
+    {GPIOF, 1}, // SCL pin PF1
+    I2C_DMA_MIN, // Bulk LCD traffic goes through DMA
+    I2C_FAST,    // 400 kHz, unless a target is slower
+    0
 };
 
-// Pointers to head and tail of the transfer queue
+// Transfer being serviced, and queues of those waiting by class
 static I2C_Xfer_t *head = NULL;
-static I2C_Xfer_t *tail = NULL;
-static int n = -1; // Number of bytes transferred, -1 when idle
+static I2C_Xfer_t *queue[I2C_PRIOS];
+static I2C_Xfer_t *tail[I2C_PRIOS];
+static int held = -1;       // Class of a finished transfer without STOP
+static bool again = false;  // Head was requested again while in service
 
-// Bit 0 of address byte indicates read vs write transfer
-#define I2C_READ  (head->addr & 0x1)
-#define I2C_WRITE (!(head->addr & 0x1))
+static I2C_WaitStats_t waitStats[I2C_PRIOS];
+static volatile int n = -1; // Bytes moved in this segment, -1 when idle
+static int seg;             // Segment of the transfer being serviced
+static I2C_Seg_t cur;       // ... its buffer, size and direction
+static int end;             // Value of n at the end of the NBYTES chunk
+static bool dma = false;    // Current segment is moved by DMA
+
+// New TIMINGR waiting for the bus to go idle
+static I2C_TypeDef *retimeIface = NULL;
+static uint32_t retimeValue;
+
+// Direction of the segment being serviced
+#define I2C_READ  (cur.read)
+#define I2C_WRITE (!cur.read)
+
+// Interrupt sources serviced by the interrupt-driven engine
+#define I2C_CR1_IRQS (I2C_CR1_TXIE | I2C_CR1_RXIE | I2C_CR1_TCIE | \
+                      I2C_CR1_STOPIE | I2C_CR1_NACKIE | I2C_CR1_ERRIE)
+
+// Bus error conditions reported through the error interrupt
+#define I2C_ISR_ERRORS (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_OVR)
+
+#define I2C_IRQ_PRIORITY 6  // Above SysTick (7), below GPIO EXTI (0)
+
+// DMA channels serving I2C2, routed through DMAMUX1 channels 0 and 1
+#define I2C_DMA_TX      DMA1_Channel1
+#define I2C_DMA_RX      DMA1_Channel2
+#define I2C_DMAMUX_TX   DMAMUX1_Channel0
+#define I2C_DMAMUX_RX   DMAMUX1_Channel1
+#define DMAMUX_I2C2_RX  19  // DMAMUX1 request inputs (RM0438 DMAMUX table)
+#define DMAMUX_I2C2_TX  20
+
+#if I2C_INTERRUPTS
+// Enable one interrupt vector in the NVIC
+static void EnableIRQ(IRQn_Type irq) {
+    NVIC->IPR[irq] = I2C_IRQ_PRIORITY << 5;
+    __COMPILER_BARRIER();
+    NVIC->ISER[irq / 32] = 1 << (irq % 32);
+    __COMPILER_BARRIER();
+}
+#endif
+
+// --------------------------------------------------------
+// Bus timing
+// --------------------------------------------------------
+// I2C-bus specification limits of each mode (ns)
+typedef struct {
+    uint32_t maxSpeed;
+    uint16_t lowMin, highMin;   // SCL low and high periods
+    uint16_t suDatMin;          // Data setup time
+    uint16_t riseMax, fallMax;  // Rise and fall times
+} I2C_Mode_t;
+
+static const I2C_Mode_t modes[] = {
+    {I2C_STANDARD,  4700, 4000, 250, 1000, 300},
+    {I2C_FAST,      1300,  600, 100,  300, 300},
+    {I2C_FAST_PLUS,  500,  260,  50,  120, 120},
+};
+#define I2C_MODES (int)(sizeof modes / sizeof modes[0])
+
+#define I2C_AF_MIN 50  // Analog noise filter delay, lower bound (ns)
+
+static uint32_t Ceil(uint32_t a, uint32_t b) {
+    return (a + b - 1) / b;
+}
+
+uint32_t I2C_Timing(uint32_t clockHz, uint32_t sclHz) {
+    int mode = 0;
+    while (mode < I2C_MODES && sclHz > modes[mode].maxSpeed)
+        mode++;
+    if (mode == I2C_MODES || clockHz == 0 || sclHz == 0)
+        return 0;
+    const I2C_Mode_t *m = &modes[mode];
+
+    // Work in picoseconds. SCL edges are taken as instant and the
+    // filters as fast as they get, so the SCL period can only come out
+    // longer than planned, never shorter.
+    uint32_t clk = 1000000000000ULL / clockHz;
+    uint32_t period = 1000000000000ULL / sclHz;
+    uint32_t sync = 2 * I2C_AF_MIN * 1000 + 4 * clk;  // SCL edge detection
+    int32_t hold = (m->fallMax - I2C_AF_MIN) * 1000 - 3 * (int32_t)clk;
+
+    // The smallest prescaler that fits gives the finest steps
+    for (uint32_t presc = 0; presc < 16; presc++) {
+        uint32_t t = (presc + 1) * clk;
+        uint32_t scldel = Ceil((m->riseMax + m->suDatMin) * 1000, t);
+        uint32_t sdadel = hold > 0 ? Ceil(hold, t) : 0;
+        uint32_t low = Ceil(m->lowMin * 1000, t);
+        uint32_t high = Ceil(m->highMin * 1000, t);
+
+        // Spread what is left of the period in proportion to the minimums
+        uint32_t total = period > sync ? Ceil(period - sync, t) : 0;
+        if (low + high < total) {
+            uint32_t extra = total - low - high;
+            uint32_t more = extra * m->lowMin / (m->lowMin + m->highMin);
+            low += more;
+            high += extra - more;
+        }
+
+        if (low <= 256 && high <= 256 && scldel <= 16 && sdadel <= 15)
+            return presc << I2C_TIMINGR_PRESC_Pos
+                 | (scldel - 1) << I2C_TIMINGR_SCLDEL_Pos
+                 | sdadel << I2C_TIMINGR_SDADEL_Pos
+                 | (high - 1) << I2C_TIMINGR_SCLH_Pos
+                 | (low - 1) << I2C_TIMINGR_SCLL_Pos;
+    }
+    return 0;
+}
+
+// TIMINGR for the bus at the current clock. The I2C kernel clock is
+// PCLK1 out of reset, which runs at the core clock.
+static uint32_t BusTiming(I2C_Bus_t bus) {
+    uint32_t speed = bus.limit && bus.limit < bus.speed ? bus.limit : bus.speed;
+    uint32_t timing = I2C_Timing(SystemCoreClock, speed);
+    if (timing == 0) {
+        LOG("i2c: no timing for %u Hz at %u Hz clock", speed, SystemCoreClock);
+        timing = I2C_Timing(SystemCoreClock, I2C_STANDARD);
+    }
+
+    if (speed > I2C_FAST) {
+        // Fast-mode Plus needs the stronger output drive on the pins
+        RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+        SYSCFG->CFGR1 |= bus.iface == I2C1 ? SYSCFG_CFGR1_I2C1_FMP :
+                         bus.iface == I2C2 ? SYSCFG_CFGR1_I2C2_FMP :
+                         bus.iface == I2C3 ? SYSCFG_CFGR1_I2C3_FMP :
+                                             SYSCFG_CFGR1_I2C4_FMP;
+    }
+    return timing;
+}
+
+// Reprogram TIMINGR if a change is waiting and the bus is free
+static void ApplyTiming(void) {
+    if (retimeIface == NULL || head != NULL || held >= 0 ||
+        (retimeIface->ISR & I2C_ISR_BUSY))
+        return;
+    retimeIface->CR1 &= ~I2C_CR1_PE; // Only writable while disabled
+    retimeIface->TIMINGR = retimeValue;
+    retimeIface->CR1 |= I2C_CR1_PE;
+    retimeIface = NULL;
+}
+
+void I2C_Retime(I2C_Bus_t bus) {
+    if (!(bus.iface->CR1 & I2C_CR1_PE))
+        return; // Not enabled yet, I2C_Enable() will set it up
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    retimeIface = bus.iface;
+    retimeValue = BusTiming(bus);
+    ApplyTiming(); // Now if idle, else once the queue drains
+    __set_PRIMASK(primask);
+}
+
+void I2C_Device(I2C_Bus_t *bus, uint8_t addr, uint32_t maxSpeed) {
+    if (bus->limit != 0 && bus->limit <= maxSpeed)
+        return; // Already running no faster than that
+
+    if (maxSpeed < bus->speed)
+        LOG("i2c: target %02X limits the bus to %u kHz", addr, maxSpeed / 1000);
+    bus->limit = maxSpeed;
+    I2C_Retime(*bus);
+}
+
+// --------------------------------------------------------
+// Bus setup
+// --------------------------------------------------------
 
 // Enable I2C controller and configure associated GPIO pins
 void I2C_Enable(I2C_Bus_t bus) {
@@ -49,53 +218,339 @@ void I2C_Enable(I2C_Bus_t bus) {
 
     // Configure I2C peripheral
     bus.iface->CR1 &= ~I2C_CR1_PE;
-    bus.iface->TIMINGR = 0xE14;
+    bus.iface->TIMINGR = BusTiming(bus);
     bus.iface->CR1 = I2C_CR1_PE;
+
+#if I2C_INTERRUPTS
+    if (bus.iface == I2C2 && bus.dmaMin > 0) {
+        // Enable DMA controller and route I2C2 requests to its channels
+        RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN | RCC_AHB1ENR_DMAMUX1EN;
+        I2C_DMAMUX_TX->CCR = DMAMUX_I2C2_TX;
+        I2C_DMAMUX_RX->CCR = DMAMUX_I2C2_RX;
+    }
+
+    // Enable event and error interrupt vectors
+    EnableIRQ(bus.iface == I2C1 ? I2C1_EV_IRQn :
+              bus.iface == I2C2 ? I2C2_EV_IRQn :
+              bus.iface == I2C3 ? I2C3_EV_IRQn : I2C4_EV_IRQn);
+    EnableIRQ(bus.iface == I2C1 ? I2C1_ER_IRQn :
+              bus.iface == I2C2 ? I2C2_ER_IRQn :
+              bus.iface == I2C3 ? I2C3_ER_IRQn : I2C4_ER_IRQn);
+#endif
+}
+
+// --------------------------------------------------------
+// Transfers
+// --------------------------------------------------------
+
+// Decide whether the current segment is moved by DMA or by the CPU
+static bool UseDMA(I2C_Xfer_t *q) {
+#if I2C_INTERRUPTS
+    return q->bus->iface == I2C2
+        && q->bus->dmaMin > 0
+        && cur.size >= q->bus->dmaMin;
+#else
+    return false;
+#endif
+}
+
+#if I2C_INTERRUPTS
+// Hand the whole segment buffer to a DMA channel
+static void StartDMA(I2C_Xfer_t *q) {
+    I2C_TypeDef *i2c = q->bus->iface;
+    DMA_Channel_TypeDef *ch = I2C_READ ? I2C_DMA_RX : I2C_DMA_TX;
+
+    ch->CCR = 0; // Disable channel before reprogramming
+    ch->CPAR  = I2C_READ ? (uint32_t)&i2c->RXDR : (uint32_t)&i2c->TXDR;
+    ch->CM0AR = (uint32_t)cur.data;
+    ch->CNDTR = cur.size;
+    ch->CCR = DMA_CCR_MINC                  // Step through memory buffer,
+            | (I2C_WRITE ? DMA_CCR_DIR : 0) // byte-wide on both sides
+            | DMA_CCR_EN;
+
+    i2c->CR1 |= I2C_READ ? I2C_CR1_RXDMAEN : I2C_CR1_TXDMAEN;
+}
+#endif
+
+// Take the next transfer to service off the queues, high priority
+// first. One that follows a transfer without STOP comes from the same
+// class, as it is the rest of that exchange.
+static I2C_Xfer_t *NextTransfer(void) {
+    int c = held >= 0 && queue[held] ? held :
+            queue[I2C_HIGH] ? I2C_HIGH : I2C_LOW;
+    I2C_Xfer_t *q = queue[c];
+    if (q != NULL) {
+        queue[c] = q->next;
+        q->next = NULL; // Unlinked now, it may be requested again meanwhile
+    }
+    return q;
+}
+
+// Segment i of a transfer, the first one being described by the record
+static I2C_Seg_t Segment(const I2C_Xfer_t *q, int i) {
+    if (i > 0)
+        return q->more[i - 1];
+    I2C_Seg_t s = {q->data, q->size, q->addr & 0x1};
+    return s;
+}
+
+// Release the DMA channels
+static void StopDMA(I2C_TypeDef *i2c) {
+    i2c->CR1 &= ~(I2C_CR1_TXDMAEN | I2C_CR1_RXDMAEN);
+    I2C_DMA_TX->CCR = 0;
+    I2C_DMA_RX->CCR = 0;
+    dma = false;
+}
+
+// Make segment i current and set up how its data is moved
+static void BeginSegment(I2C_Xfer_t *q, int i) {
+    I2C_TypeDef *i2c = q->bus->iface;
+
+    seg = i;
+    cur = Segment(q, i);
+    n = 0;
+    if (dma)
+        StopDMA(i2c);
+    dma = UseDMA(q);
+#if I2C_INTERRUPTS
+    if (dma) {
+        // DMA moves the data, interrupts only report completion
+        StartDMA(q);
+        i2c->CR1 = (i2c->CR1 & ~I2C_CR1_IRQS)
+                 | (I2C_CR1_IRQS & ~(I2C_CR1_TXIE | I2C_CR1_RXIE));
+    } else {
+        i2c->CR1 |= I2C_CR1_IRQS;
+    }
+#endif
+}
+
+// NBYTES, RELOAD and AUTOEND for the next chunk of the current segment:
+// at most 255 bytes, reloaded while more follow in the same direction,
+// and AUTOEND after the last byte of a transfer that ends with STOP
+static uint32_t Chunk(const I2C_Xfer_t *q) {
+    int left = cur.size - n;
+    int bytes = left < 255 ? left : 255;
+    bool last = seg == q->moreSegs;
+    bool reload = bytes < left || (!last && q->more[seg].read == cur.read);
+
+    end = n + bytes;
+    return bytes << I2C_CR2_NBYTES_Pos
+         | reload << I2C_CR2_RELOAD_Pos
+         | (last && bytes == left && q->stop) << I2C_CR2_AUTOEND_Pos;
+}
+
+// Carry on after the end of a chunk (TCR or TC): reload NBYTES for more
+// bytes in the same direction, or issue a repeated START for a segment
+// going the other way
+static void NextChunk(I2C_Xfer_t *q) {
+    I2C_TypeDef *i2c = q->bus->iface;
+    bool turn = false;
+
+    if (n == cur.size) {
+        turn = q->more[seg].read != cur.read;
+        BeginSegment(q, seg + 1);
+    }
+    i2c->CR2 = (i2c->CR2 & ~(I2C_CR2_NBYTES | I2C_CR2_RELOAD |
+                             I2C_CR2_AUTOEND | I2C_CR2_RD_WRN))
+             | I2C_READ << I2C_CR2_RD_WRN_Pos
+             | Chunk(q)
+             | (turn ? I2C_CR2_START : 0);
+}
+
+// Issue START for the transfer at the head of the queue
+static void StartTransfer(void) {
+    I2C_Xfer_t *q = head;
+    I2C_TypeDef *i2c = q->bus->iface;
+
+    I2C_WaitStats_t *w = &waitStats[q->prio];
+    uint32_t wait = (uint32_t)TimeNowUs() - q->queued;
+    w->count++;
+    w->waitUs += wait;
+    if (wait > w->maxWaitUs)
+        w->maxWaitUs = wait;
+
+    i2c->ICR = 0xFFFF; // Clear flags
+    BeginSegment(q, 0);
+    i2c->CR2 = (q->addr & 0xFE)
+             | I2C_READ << I2C_CR2_RD_WRN_Pos
+             | Chunk(q)
+             | I2C_CR2_START;
+}
+
+// Remove the completed transfer from the head of the queue
+static void FinishTransfer(void) {
+    I2C_Xfer_t *q = head;
+
+    if (dma)
+        StopDMA(q->bus->iface);
+
+    held = q->stop ? -1 : q->prio;
+    q->busy = again; // Mark transfer as complete, unless queued again
+    again = false;
+    head = NextTransfer();
+    n = -1;          // Prepare for next transfer
+
+#if I2C_INTERRUPTS
+    if (head != NULL)
+        StartTransfer(); // Repeated START if the last one had no STOP
+    else {
+        ApplyTiming();
+        q->bus->iface->CR1 &= ~I2C_CR1_IRQS; // Bus idle, TC may stay set
+        WakeNow(); // Queue drained, let the main loop queue more
+    }
+#endif
 }
 
 // Add a transfer request to the queue
 void I2C_Request(I2C_Xfer_t *p) {
-    if (head == NULL)
-        head = p; // Add to empty queue
+    // The interrupt handler also walks the queue
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // Still waiting in the queue: it sends its buffer as it is when its
+    // turn comes, so there is nothing to add (and relinking it would
+    // cut the queue after it)
+    if (p->busy && (p != head || again)) {
+        __set_PRIMASK(primask);
+        return;
+    }
+    if (p == head)
+        again = true; // Back in the queue, still busy once this run ends
+
+    I2C_Prio_t c = p->prio;
+    if (queue[c] == NULL)
+        queue[c] = p; // Add to empty queue
     else
-        tail->next = p; // Add to tail of non-empty queue
-    tail = p;
+        tail[c]->next = p; // Add to tail of non-empty queue
+    tail[c] = p;
     p->next = NULL;
     p->busy = true; // Mark transfer as in-progress
+    p->queued = TimeNowUs();
+
+#if I2C_INTERRUPTS
+    if (n == -1) {
+        ApplyTiming();
+        head = NextTransfer();
+        StartTransfer(); // Bus was idle, kick off the engine
+    }
+#endif
+
+    __set_PRIMASK(primask);
+}
+
+I2C_WaitStats_t I2C_WaitStats(I2C_Prio_t c) {
+    // Updated by the interrupt handler, take the 64-bit sum in one piece
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    I2C_WaitStats_t w = waitStats[c];
+    __set_PRIMASK(primask);
+    return w;
+}
+
+bool I2C_Idle(void) {
+    return head == NULL && held < 0 &&
+           queue[I2C_HIGH] == NULL && queue[I2C_LOW] == NULL;
 }
 
 // Polling implementation, called from main loop every tick
 void ServiceI2CRequests(void) {
+#if !I2C_INTERRUPTS
+    if (head == NULL) {
+        ApplyTiming(); // Waits for the last STOP to go out
+        head = NextTransfer();
+    }
     if (head == NULL)
         return; // Nothing to do right now
 
+    WakeAt(TimeNow() + 1); // One step per tick until the queue drains
+
     I2C_Xfer_t *q = head;
     I2C_TypeDef *i2c = q->bus->iface;
 
     if (n == -1) {
         // Begin a new transfer
-        n = 0;
-        i2c->ICR = 0xFFFF; // Clear flags
-        i2c->CR2 = (q->addr & 0xFE)
-                 | I2C_READ << I2C_CR2_RD_WRN_Pos
-                 | q->size << I2C_CR2_NBYTES_Pos
-                 | q->stop << I2C_CR2_AUTOEND_Pos
-                 | I2C_CR2_START;
-    }
-    else if (n < q->size) {
+        StartTransfer();
+    }
+    else if (n < end) {
         if (i2c->ISR & I2C_ISR_TXIS)
             // Copy transmit data from memory buffer to hardware buffer
-            i2c->TXDR = q->data[n++];
+            i2c->TXDR = cur.data[n++];
 
         if (i2c->ISR & I2C_ISR_RXNE)
             // Copy receive data from hardware buffer to memory buffer
-            q->data[n++] = i2c->RXDR;
+            cur.data[n++] = i2c->RXDR;
+    }
+    else if (n < cur.size || seg < q->moreSegs) {
+        // Chunk done, continue once the controller waits for it
+        if (i2c->ISR & (I2C_ISR_TCR | I2C_ISR_TC))
+            NextChunk(q);
     }
     else {
-        // Remove transfer from head of queue
-        head = q->next;
-        q->next = NULL;
-        q->busy = 0; // Mark transfer as complete
-        n = -1;      // Prepare for next transfer
+        FinishTransfer();
     }
+#endif
+    // Interrupt-driven engine drains the queue in the background
 }
+
+// --------------------------------------------------------
+// Interrupt handling
+// --------------------------------------------------------
+
+// Common event/error handler, services the transfer at the head of the queue
+void I2C_IRQHandler(I2C_TypeDef *i2c) {
+    I2C_Xfer_t *q = head;
+    uint32_t isr = i2c->ISR;
+
+    if (q == NULL || n == -1) {
+        i2c->CR1 &= ~I2C_CR1_IRQS; // Spurious, nothing in progress
+        return;
+    }
+
+    if (dma)
+        n = cur.size - (I2C_READ ? I2C_DMA_RX : I2C_DMA_TX)->CNDTR;
+
+    else if (isr & I2C_ISR_TXIS)
+        // Copy transmit data from memory buffer to hardware buffer
+        i2c->TXDR = n < end ? cur.data[n++] : 0;
+
+    else if (isr & I2C_ISR_RXNE) {
+        // Copy receive data from hardware buffer to memory buffer
+        uint8_t data = i2c->RXDR;
+        if (n < end)
+            cur.data[n++] = data;
+    }
+
+    // Acknowledge the events handled below in one write (ICR bits
+    // share their positions with the ISR flags)
+    i2c->ICR = isr & (I2C_ISR_NACKF | I2C_ISR_STOPF | I2C_ISR_ERRORS);
+
+    if ((isr & I2C_ISR_NACKF) && !(i2c->CR2 & I2C_CR2_AUTOEND))
+        // Target did not acknowledge, AUTOEND issues the STOP by itself
+        i2c->CR2 |= I2C_CR2_STOP;
+
+    if (isr & I2C_ISR_ERRORS)
+        // Abandon the transfer, controller has released the bus
+        FinishTransfer();
+    else if (isr & I2C_ISR_STOPF)
+        FinishTransfer();
+    else if (isr & I2C_ISR_TCR)
+        // Chunk done, more bytes follow in the same direction
+        NextChunk(q);
+    else if ((isr & I2C_ISR_TC) && seg < q->moreSegs)
+        // Message done, next segment goes the other way
+        NextChunk(q);
+    else if ((isr & I2C_ISR_TC) && !q->stop) {
+        // All bytes sent without STOP, bus is held for a repeated START
+        FinishTransfer();
+    }
+}
+
+// Dispatch I2C IRQs to common handler function
+void I2C1_EV_IRQHandler() { I2C_IRQHandler(I2C1); }
+void I2C1_ER_IRQHandler() { I2C_IRQHandler(I2C1); }
+void I2C2_EV_IRQHandler() { I2C_IRQHandler(I2C2); }
+void I2C2_ER_IRQHandler() { I2C_IRQHandler(I2C2); }
+void I2C3_EV_IRQHandler() { I2C_IRQHandler(I2C3); }
+void I2C3_ER_IRQHandler() { I2C_IRQHandler(I2C3); }
+void I2C4_EV_IRQHandler() { I2C_IRQHandler(I2C4); }
+void I2C4_ER_IRQHandler() { I2C_IRQHandler(I2C4); }
@@ -0,0 +1,104 @@
+// Debounce and edge detection for GPIOX buttons
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "input.h"
+#include "gpio.h"
+#include "sched.h"
+
+// --------------------------------------------------------
+// Debouncer state
+// --------------------------------------------------------
+// Bit n of ct1:ct0 is the 2-bit count of bit n, idle at 3. It counts
+// down on each sample differing from the debounced state, and the
+// state toggles when it rolls over to 3 again.
+static uint16_t state = 0;                   // Debounced levels
+static uint16_t ct0 = 0xFFFF, ct1 = 0xFFFF;  // Vertical counter
+static uint16_t counting = 0;                // Bits on their way to a change
+static Time_t lastSample;
+
+static InputEvents_t events;    // Accumulated until InputRead()
+static void (*consumer)(void) = NULL;  // Task told about new events
+
+// Long presses
+static Time_t longTime[16];     // Per bit, 0 = not reported
+static uint16_t longMask = 0;   // Bits with a long-press time
+static Time_t downAt[16];       // When each bit last went down
+static uint16_t longPending = 0;  // Down, long press not reported yet
+
+// --------------------------------------------------------
+// Sampling
+// --------------------------------------------------------
+void InputUpdate(void) {
+    Time_t now = TimeNow();
+    uint16_t delta = GPIO_PortInput(GPIOX) ^ state;
+    uint16_t before = events.pressed | events.released | events.held;
+
+    // Start on a change, then keep sampling at the interval until every
+    // bit has settled; bits that bounce back reset their count
+    if (counting ? TimePassed(lastSample) >= INPUT_SAMPLE_MS : delta != 0) {
+        lastSample = now;
+        ct0 = ~(ct0 & delta);
+        ct1 = ct0 ^ (ct1 & delta);
+        uint16_t toggle = delta & ct0 & ct1;
+        state ^= toggle;
+        counting = delta & ~toggle;
+
+        if (toggle) {
+            uint16_t down = toggle & state;
+            events.pressed |= down;
+            events.released |= toggle & ~state;
+            events.time = now;
+
+            for (uint16_t bits = down; bits; bits &= bits - 1)
+                downAt[__builtin_ctz(bits)] = now;
+            longPending = (longPending & state) | (down & longMask);
+        }
+    }
+    if (counting)
+        WakeAt(lastSample + INPUT_SAMPLE_MS);
+
+    // Long presses falling due
+    for (uint16_t bits = longPending; bits; bits &= bits - 1) {
+        int b = __builtin_ctz(bits);
+        Time_t due = downAt[b] + longTime[b];
+        if ((int)(now - due) >= 0) {
+            events.held |= 1 << b;
+            events.time = now;
+            longPending &= ~(1 << b);
+        } else
+            WakeAt(due);
+    }
+
+    // Apps have already run this pass, let them see new events on the next
+    if ((events.pressed | events.released | events.held) != before)
+        SchedSignal(consumer);
+}
+
+// --------------------------------------------------------
+// Event delivery
+// --------------------------------------------------------
+InputEvents_t InputRead(void) {
+    InputEvents_t e = events;
+    e.state = state;
+    events.pressed = 0;
+    events.released = 0;
+    events.held = 0;
+    return e;
+}
+
+void InputNotify(void (*task)(void)) {
+    consumer = task;
+}
+
+void InputLongPress(uint16_t mask, Time_t ms) {
+    for (int b = 0; b < 16; b++) {
+        if (mask & (1 << b))
+            longTime[b] = ms;
+        if (longTime[b])
+            longMask |= 1 << b;
+        else
+            longMask &= ~(1 << b);
+    }
+    longPending &= longMask;
+}
@@ -0,0 +1,86 @@
+// Deferred binary logging over ITM
+
+#include <stdbool.h>
+#include "log.h"
+#include "systick.h"
+
+#if LOG_RING_WORDS & (LOG_RING_WORDS - 1)
+#error LOG_RING_WORDS must be a power of two
+#endif
+
+// 32-bit stimulus port write, after FIFOREADY was seen (the simulator
+// takes the words from here)
+#ifndef ITM_Send32
+#define ITM_Send32(port, w) (ITM->PORT[port].u32 = (w))
+#endif
+
+static uint32_t ring[LOG_RING_WORDS];
+static volatile uint32_t head = 0;     // Next word to fill, writers only
+static volatile uint32_t tail = 0;     // Next word to send, LogDrain() only
+static volatile uint32_t dropped = 0;  // Records not reported yet
+static uint32_t droppedTotal = 0;
+
+// --------------------------------------------------------
+// Writing
+// --------------------------------------------------------
+void LogWrite(uint32_t header, const uint32_t *args) {
+    uint32_t n = header & LOG_MAX_ARGS;
+
+    // Interrupts are off for the copy only, so handlers of any priority
+    // can log too
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t h = head;
+    if (LOG_RING_WORDS - (h - tail) <= n) {
+        dropped++;
+        droppedTotal++;
+    } else {
+        ring[h++ & (LOG_RING_WORDS - 1)] = header;
+        for (uint32_t i = 0; i < n; i++)
+            ring[h++ & (LOG_RING_WORDS - 1)] = args[i];
+        head = h;
+    }
+    __set_PRIMASK(primask);
+}
+
+uint32_t LogDropped(void) {
+    return droppedTotal;
+}
+
+// --------------------------------------------------------
+// Draining
+// --------------------------------------------------------
+static bool PortEnabled(void) {
+    return (ITM->TCR & ITM_TCR_ITMENA_Msk) && (ITM->TER & (1u << LOG_PORT));
+}
+
+void LogDrain(void) {
+    if (!PortEnabled()) {
+        tail = head;  // Nobody listening, do not let old records pile up
+        return;
+    }
+
+    while (1) {
+        uint32_t t = tail;
+        for (uint32_t h = head; t != h; t++) {
+            if (ITM->PORT[LOG_PORT].u32 == 0) {
+                tail = t;
+                WakeAt(TimeNow() + 1);  // FIFO full, try again shortly
+                return;
+            }
+            ITM_Send32(LOG_PORT, ring[t & (LOG_RING_WORDS - 1)]);
+        }
+        tail = t;
+
+        if (dropped == 0)
+            return;
+
+        // Ring is empty now, report what was lost in its place
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t lost = dropped;
+        dropped = 0;
+        __set_PRIMASK(primask);
+        LOG("log: %u records dropped", lost);
+    }
+}
@@ -4,19 +4,63 @@
 
 #include <stdio.h>
 #include "systick.h"
+#include "clock.h"
 #include "i2c.h"
 #include "gpio.h"
 #include "alarm.h"
 #include "game.h"
 #include "display.h"   // ✅ Added as per Lab 2 instructions
+#include "profile.h"
+#include "timer.h"
+#include "input.h"
+#include "sched.h"
+#include "log.h"
+
+#if PROFILE
+// Print and restart the profile and scheduler statistics
+static void Task_Report(void) {
+    ProfileDump();
+    ProfileReset();
+    SchedDump();
+
+    static const char *const prio[I2C_PRIOS] = {"low", "high"};
+    for (int c = 0; c < I2C_PRIOS; c++) {
+        I2C_WaitStats_t w = I2C_WaitStats(c);
+        printf("i2c %-4s %8lu xfers, wait avg %lu max %lu us\n", prio[c],
+               (unsigned long)w.count,
+               (unsigned long)(w.count ? w.waitUs / w.count : 0),
+               (unsigned long)w.maxWaitUs);
+    }
+}
+#endif
+
+// --------------------------------------------------------
+// Task table
+// --------------------------------------------------------
+// Both apps run side by side, each only when its timers or inputs
+// signal it. The housekeeping after them checks its work on every pass.
+static Task_t tasks[] = {
+    //    name       init        run                period            prio  profile
+    TASK("alarm",   Init_Alarm, Task_Alarm,        SCHED_ON_SIGNAL,  0,    PROF_ALARM),
+    TASK("game",    Init_Game,  Task_Game,         SCHED_ON_SIGNAL,  1,    PROF_GAME),
+    TASK("iox",     NULL,       UpdateIOExpanders, SCHED_EVERY_PASS, 2,    PROF_IOX),
+    TASK("input",   NULL,       InputUpdate,       SCHED_EVERY_PASS, 3,    PROF_INPUT),
+    TASK("display", NULL,       UpdateDisplay,     SCHED_EVERY_PASS, 4,    PROF_DISPLAY),
+    TASK("i2c",     NULL,       ServiceI2CRequests, SCHED_EVERY_PASS, 5,   PROF_I2C),
+#if PROFILE
+    TASK("report",  NULL,       Task_Report,       PROF_REPORT_MS,   6,    PROF_REPORT),
+#endif
+};
 
 int main(void)
 {
     // ----------------------------------------------------
     // Initialization
     // ----------------------------------------------------
+    ClockSet(CLOCK_PROFILE); // PLL at 110 MHz unless built for low power
     StartSysTick();         // Enable system tick timer
     I2C_Enable(LeafyI2C);   // Enable I2C peripheral
+    PROFILE_INIT();         // Cycle counter (debug builds only)
 
     // --------------------------------------------------------
     // Function prototypes (must appear BEFORE Init_Game)
@@ -24,23 +68,19 @@ int main(void)
     void CallbackSelectPress(void);
     void CallbackSelectRelease(void);
 
-//    Init_Alarm();           // Initialize alarm system
-    Init_Game();            // Initialize game system
+    SchedStart(tasks, sizeof tasks / sizeof tasks[0]);  // Initialize alarm & game
 
 
     // ----------------------------------------------------
     // Main loop
     // ----------------------------------------------------
     while (1) {
-//        Task_Alarm();           // Handle alarm state machine
-        Task_Game();            // Handle game logic
-
-        // ------------------------------------------------
-        // Housekeeping
-        // ------------------------------------------------
-        UpdateIOExpanders();    // Update LED/button I/O expanders
-        UpdateDisplay();        // ✅ Added right after UpdateIOExpanders()
-        ServiceI2CRequests();   // Handle queued I2C transactions
-        WaitForSysTick();       // 1 ms tick delay
+        PROFILE_START(loop);
+        TimerService();         // Expire software timers, signalling tasks
+        SchedRun();             // Apps, then LED/button, display and I2C upkeep
+        PROFILE_LAP(PROF_LOOP, loop);
+
+        LogDrain();             // Deferred log records out over ITM
+        WaitForEvent();         // Sleep until next deadline or interrupt
     }
 }
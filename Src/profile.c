@@ -0,0 +1,135 @@
+// --------------------------------------------------------
+// Main loop profiler
+// --------------------------------------------------------
+// Sections of the main loop are timed with the DWT cycle counter.
+// Each section keeps min/max/sum and a logarithmic histogram from
+// which percentiles are estimated; results are printed over ITM
+// (see __io_putchar in debug.c).
+
+#include "profile.h"
+
+#if PROFILE
+
+#include <stdio.h>
+#include "stm32l5xx.h"
+
+static const char *const names[PROF_NUM] = {
+    "alarm", "game", "iox", "input", "display", "i2c", "loop", "report"
+};
+
+static ProfStat_t stats[PROF_NUM];
+
+// The report runs within a loop pass, its cycles are taken out of that
+// pass so that printing does not show up as loop time
+static uint32_t reportCycles = 0;
+
+// --------------------------------------------------------
+// Histogram buckets
+// --------------------------------------------------------
+// Values 0-3 have a bucket each, above that every power of two is
+// split in four using the two bits below the leading one.
+static unsigned Bucket(uint32_t cycles) {
+    if (cycles < 4)
+        return cycles;
+    unsigned log2 = 31 - __CLZ(cycles);
+    unsigned b = 4 * (log2 - 1) + ((cycles >> (log2 - 2)) & 3);
+    return b < PROF_BUCKETS ? b : PROF_BUCKETS - 1;
+}
+
+// Smallest value that falls in a bucket
+static uint32_t BucketFloor(unsigned b) {
+    if (b < 4)
+        return b;
+    return (4 + b % 4) << (b / 4 - 1);
+}
+
+// --------------------------------------------------------
+// Recording
+// --------------------------------------------------------
+void ProfileInit(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk; // Power up DWT/ITM
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    ProfileReset();
+}
+
+void ProfileReset(void) {
+    for (int i = 0; i < PROF_NUM; i++)
+        stats[i] = (ProfStat_t){.min = UINT32_MAX};
+}
+
+uint32_t ProfileStamp(void) {
+    return DWT->CYCCNT;
+}
+
+uint32_t ProfileLap(ProfId_t id, uint32_t since) {
+    uint32_t now = DWT->CYCCNT;
+    uint32_t cycles = now - since; // Wraps correctly
+    ProfStat_t *s = &stats[id];
+
+    if (id == PROF_REPORT)
+        reportCycles += cycles;
+    else if (id == PROF_LOOP) {
+        cycles -= reportCycles;
+        reportCycles = 0;
+    }
+
+    s->n++;
+    s->sum += cycles;
+    if (cycles < s->min)
+        s->min = cycles;
+    if (cycles > s->max)
+        s->max = cycles;
+
+    uint16_t *h = &s->hist[Bucket(cycles)];
+    if (*h != UINT16_MAX)
+        (*h)++;
+
+    return now;
+}
+
+// --------------------------------------------------------
+// Results
+// --------------------------------------------------------
+const ProfStat_t *ProfileStat(ProfId_t id) {
+    return &stats[id];
+}
+
+uint32_t ProfilePercentile(ProfId_t id, unsigned pct) {
+    const ProfStat_t *s = &stats[id];
+    uint32_t total = 0, count = 0;
+
+    if (s->n == 0)
+        return 0;
+    for (unsigned b = 0; b < PROF_BUCKETS; b++)
+        total += s->hist[b];
+
+    // Walk the histogram until pct percent of the samples are covered
+    for (unsigned b = 0; b < PROF_BUCKETS; b++) {
+        count += s->hist[b];
+        if (count * 100 >= total * pct) {
+            uint32_t top = b + 1 < PROF_BUCKETS ? BucketFloor(b + 1) - 1 : s->max;
+            return top < s->max ? top : s->max;
+        }
+    }
+    return s->max;
+}
+
+void ProfileDump(void) {
+    printf("%-8s %8s %8s %8s %8s %8s %8s\n",
+           "section", "n", "min", "avg", "p50", "p99", "max");
+    for (int i = 0; i < PROF_NUM; i++) {
+        const ProfStat_t *s = &stats[i];
+        if (s->n == 0)
+            continue;
+        printf("%-8s %8lu %8lu %8lu %8lu %8lu %8lu\n", names[i],
+               (unsigned long)s->n,
+               (unsigned long)s->min,
+               (unsigned long)(s->sum / s->n),
+               (unsigned long)ProfilePercentile(i, 50),
+               (unsigned long)ProfilePercentile(i, 99),
+               (unsigned long)s->max);
+    }
+}
+
+#endif
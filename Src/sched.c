@@ -0,0 +1,107 @@
+// Cooperative task scheduler
+
+#include <stdio.h>
+#include <stddef.h>
+#include "sched.h"
+#include "profile.h"
+
+static Task_t *tasks = NULL;
+static int numTasks = 0;
+
+// Periodic tasks, as opposed to every-pass and signal-only ones
+static bool Periodic(const Task_t *t) {
+    return t->period != SCHED_EVERY_PASS && t->period != SCHED_ON_SIGNAL;
+}
+
+// --------------------------------------------------------
+// Initialization
+// --------------------------------------------------------
+void SchedStart(Task_t *table, int count) {
+    // Order by priority once, so that a pass is a walk down the table;
+    // equal priorities keep their order in the table
+    for (int i = 1; i < count; i++) {
+        Task_t t = table[i];
+        int j = i;
+        while (j > 0 && table[j - 1].priority > t.priority) {
+            table[j] = table[j - 1];
+            j--;
+        }
+        table[j] = t;
+    }
+    tasks = table;
+    numTasks = count;
+
+    for (int i = 0; i < count; i++) {
+        if (tasks[i].init)
+            tasks[i].init();
+        tasks[i].deadline = TimeNow() + tasks[i].period;  // Periodic ones
+    }
+}
+
+// --------------------------------------------------------
+// Running
+// --------------------------------------------------------
+void SchedRun(void) {
+    Time_t now = TimeNow();
+
+    for (int i = 0; i < numTasks; i++) {
+        Task_t *t = &tasks[i];
+        bool due = t->period == SCHED_EVERY_PASS ||
+                   (Periodic(t) && (int)(now - t->deadline) >= 0);
+        if (!due && !t->signalled)
+            continue;
+        t->signalled = false;  // Signals raised while it runs count again
+
+        if (due && Periodic(t)) {
+            Time_t lateness = now - t->deadline;
+            if (lateness > t->maxLate)
+                t->maxLate = lateness;
+            if (lateness >= t->period)
+                t->late++;
+            // Keep the phase, but do not try to catch up on missed runs
+            t->deadline += t->period;
+            if ((int)(now - t->deadline) >= 0)
+                t->deadline = now + t->period;
+        }
+
+        PROFILE_START(p);
+        uint64_t start = TimeNowUs();
+        t->run();
+        uint32_t us = TimeNowUs() - start;
+        PROFILE_LAP(t->prof, p);
+
+        t->runs++;
+        t->busyUs += us;
+        if (us > t->maxUs)
+            t->maxUs = us;
+    }
+
+    // Come back for the next periodic run
+    for (int i = 0; i < numTasks; i++)
+        if (Periodic(&tasks[i]))
+            WakeAt(tasks[i].deadline);
+}
+
+void SchedSignal(void (*run)(void)) {
+    for (int i = 0; i < numTasks; i++)
+        if (tasks[i].run == run)
+            tasks[i].signalled = true;
+    WakeNow();
+}
+
+// --------------------------------------------------------
+// Statistics
+// --------------------------------------------------------
+void SchedDump(void) {
+    printf("%-8s %8s %10s %8s %6s %8s\n",
+           "task", "runs", "busy us", "max us", "late", "max late");
+    for (int i = 0; i < numTasks; i++) {
+        const Task_t *t = &tasks[i];
+        printf("%-8s %8lu %10lu %8lu %6lu %8lu\n", t->name,
+               (unsigned long)t->runs,
+               (unsigned long)t->busyUs,
+               (unsigned long)t->maxUs,
+               (unsigned long)t->late,
+               (unsigned long)t->maxLate);
+    }
+}
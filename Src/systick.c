@@ -1,14 +1,39 @@
 // Manage the system timer
 
+#include <stdbool.h>
 #include "systick.h"
 
-#define SYSTICKS 4000  // 1ms with 4MHz clock
+uint32_t SystemCoreClock = 4000000;  // Core clock in Hz (CMSIS), MSI at reset
 
-static volatile Time_t sysTime = 0;
+// SysTick cycles in 1 ms, and the longest count-down that fits in the
+// 24-bit counter at this clock; both follow SystemCoreClock
+static uint32_t sysTicks = 4000;
+static Time_t maxSleep = MAX_SLEEP;
+
+// --------------------------------------------------------
+// Time keeping
+// --------------------------------------------------------
+// SysTick always counts down towards a millisecond boundary, tickEnd.
+// Normally that is the next one, 1 ms away, but for tickless idle the
+// count-down is stretched to end at the wake-up deadline. Either way
+// the millisecond boundaries fall where VAL crosses a multiple of
+// sysTicks, so the current time follows from tickEnd and VAL.
+// Kept in 64 bits so that it never wraps; only the handler writes it
+// outside of sections with interrupts disabled.
+static volatile uint64_t tickEnd = 1;
+
+// Derive the tick from the core clock
+static void TickRate(void) {
+    sysTicks = SystemCoreClock / 1000;
+    maxSleep = 0xFFFFFF / sysTicks;
+    if (maxSleep > MAX_SLEEP)
+        maxSleep = MAX_SLEEP;
+}
 
 void StartSysTick() {
-    sysTime = 0;
-    SysTick->LOAD = (uint32_t)(SYSTICKS - 1);  // Set reload register value
+    TickRate();
+    tickEnd = 1;
+    SysTick->LOAD = (uint32_t)(sysTicks - 1);  // Set reload register value
     SCB->SHPR[12+SysTick_IRQn] = 7 << 5;       // Set interrupt priority
     SysTick->VAL = 0;
     SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk |
@@ -18,32 +43,175 @@ void StartSysTick() {
 
 // Interrupt handler
 void SysTick_Handler(void) {
-    sysTime++;
+    tickEnd++;  // Reloaded from LOAD, which is 1 ms outside SetTickEnd()
 }
 
-// Wait for system time to change
-void WaitForSysTick(void) {
-    int wasTime = sysTime;
-    while (sysTime == wasTime)
-        __asm volatile ("wfi");  // keep CPU asleep until next interrupt
-}
+// Current millisecond and the SysTick cycles elapsed within it, taken
+// together so that the pair is consistent (callable from any context)
+static uint64_t Now(uint32_t *cycles) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
 
-// Delay measured in milliseconds
-void msDelay(int t) {
-    for (int i = 0; i < t; i++)
-        WaitForSysTick();
+    uint32_t val = SysTick->VAL;
+    uint64_t now = tickEnd - 1 - val / sysTicks;
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        // Count-down ended, handler has not run yet. VAL may have been
+        // read either side of the reload, it is from the new 1 ms now.
+        val = SysTick->VAL;
+        now = tickEnd;
+    }
+    *cycles = sysTicks - 1 - val % sysTicks;
+
+    __set_PRIMASK(primask);
+    return now;
 }
 
 // Obtain the current system time
 Time_t TimeNow(void) {
-    return sysTime;
+    uint32_t cycles;
+    return Now(&cycles);
+}
+
+// Milliseconds since StartSysTick(), never wraps
+uint64_t TimeNow64(void) {
+    uint32_t cycles;
+    return Now(&cycles);
+}
+
+// Microseconds since StartSysTick(), never wraps
+uint64_t TimeNowUs(void) {
+    uint32_t cycles;
+    uint64_t ms = Now(&cycles);
+    return ms * 1000 + cycles * 1000 / sysTicks;
 }
 
 // Calculate elapsed time since a previous event
 Time_t TimePassed(Time_t since) {
-    Time_t now = sysTime;
+    Time_t now = TimeNow();
     if (now >= since)
         return now - since;
     else  // handle rollover
         return now + 1 + TIME_MAX - since;
 }
+
+// Follow a change of SystemCoreClock made just before: the rest of the
+// current millisecond is counted out at the new rate, so no time is lost
+void RetuneSysTick(void) {
+    if (!(SysTick->CTRL & SysTick_CTRL_ENABLE_Msk))
+        return;  // Not started, StartSysTick() picks up the clock
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    uint32_t cycles;
+    uint64_t now = Now(&cycles);  // In cycles of the old rate
+    uint32_t oldTicks = sysTicks;
+    TickRate();
+    uint32_t left = (uint64_t)(oldTicks - 1 - cycles) * sysTicks / oldTicks;
+
+    SysTick->LOAD = left ? left : 1;
+    SysTick->VAL = 0;              // Restart the count-down from LOAD
+    (void)SysTick->VAL;
+    SysTick->LOAD = sysTicks - 1;  // Then 1 ms periods
+    SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+    tickEnd = now + 1;
+
+    __set_PRIMASK(primask);
+}
+
+// --------------------------------------------------------
+// Sleeping
+// --------------------------------------------------------
+static Time_t wakeAt;                 // Earliest deadline of this loop pass
+static bool wakeSet = false;          // ... if any was requested
+static volatile bool wakeup = false;  // Raised by interrupt handlers
+
+// Request a main loop pass no later than time t (interrupt safe)
+void WakeAt(Time_t t) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (!wakeSet || (int)(t - wakeAt) < 0)
+        wakeAt = t;
+    wakeSet = true;
+    __set_PRIMASK(primask);
+}
+
+// Request a main loop pass as soon as possible (interrupt safe)
+void WakeNow(void) {
+    wakeup = true;
+}
+
+#if TICKLESS_IDLE
+// Make the current count-down end at a millisecond boundary, called
+// with interrupts disabled and deadline - TimeNow() in 1..maxSleep
+static void SetTickEnd(Time_t deadline) {
+    if (deadline == (Time_t)tickEnd || (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk))
+        return;  // Already there, or about to reach tickEnd anyway
+
+    // Remainder of this millisecond, then whole milliseconds, minus the
+    // few cycles spent in here
+    uint32_t val = SysTick->VAL;
+    uint64_t now = tickEnd - 1 - val / sysTicks;
+    Time_t ahead = deadline - (Time_t)now;
+    uint32_t load = val % sysTicks + (ahead - 1) * sysTicks;
+
+    SysTick->LOAD = load ? load : 1;
+    SysTick->VAL = 0;              // Restart the count-down from LOAD,
+    (void)SysTick->VAL;            // which is latched on the next clock
+    SysTick->LOAD = sysTicks - 1;  // Back to 1 ms once it ends
+
+    // The old count-down may have run out after the check above. Its
+    // handler would count the new end as reached, so drop it: the
+    // millisecond it ended has only just begun and the new count-down
+    // (at least 1 ms, or deadline would have been tickEnd) covers it.
+    if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)
+        SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+    tickEnd = now + ahead;
+}
+#endif
+
+// Sleep until the earliest WakeAt() time or an interrupt calling WakeNow().
+// Without TICKLESS_IDLE this is the next 1 ms tick.
+void WaitForEvent(void) {
+#if TICKLESS_IDLE
+    __disable_irq();
+    Time_t now = TimeNow();
+    Time_t deadline = now + maxSleep;
+    if (wakeSet && (int)(wakeAt - now) < (int)maxSleep)
+        deadline = wakeAt;
+    wakeSet = false;
+
+    if ((int)(deadline - now) > 0) {
+        SetTickEnd(deadline);
+        while (!wakeup && (int)(TimeNow() - deadline) < 0) {
+            __WFI();         // Pending interrupts end WFI even while masked
+            __enable_irq();  // Take them
+            __disable_irq();
+        }
+    }
+    wakeup = false;
+    __enable_irq();
+#else
+    wakeSet = false;
+    WaitForSysTick();
+#endif
+}
+
+// Wait for system time to change
+void WaitForSysTick(void) {
+    Time_t wasTime = TimeNow();
+    while (TimeNow() == wasTime) {
+#if TICKLESS_IDLE
+        WakeAt(wasTime + 1);
+        WaitForEvent();
+#else
+        __WFI();  // keep CPU asleep until next interrupt
+#endif
+    }
+}
+
+// Delay measured in milliseconds
+void msDelay(int t) {
+    for (int i = 0; i < t; i++)
+        WaitForSysTick();
+}
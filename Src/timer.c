@@ -0,0 +1,216 @@
+// Hierarchical timer wheel
+
+#include <stddef.h>
+#include <stdint.h>
+#include "timer.h"
+
+// --------------------------------------------------------
+// Wheel geometry
+// --------------------------------------------------------
+// Level l holds timers due 64^l to 64^(l+1) ms from now, filed by bits
+// 6l..6l+5 of their expiry time. A slot of level 1 or 2 is re-filed
+// (cascaded) when the wheel reaches the start of its time range.
+#define LEVELS     3
+#define SLOT_BITS  6
+#define SLOTS      (1 << SLOT_BITS)
+#define SLOT_MASK  (SLOTS - 1)
+#define SHIFT(l)   ((l) * SLOT_BITS)
+#define WHEEL_SPAN (1u << SHIFT(LEVELS))  // 262144 ms, longer waits re-file
+
+static Timer_t *wheel[LEVELS][SLOTS];
+static uint64_t occupied[LEVELS];   // One bit per non-empty slot
+static Time_t wheelTime = 0;        // Next millisecond to be processed
+
+// --------------------------------------------------------
+// Slot lists
+// --------------------------------------------------------
+static void Link(Timer_t *t, int level, int slot) {
+    Timer_t **head = &wheel[level][slot];
+    t->next = *head;
+    if (t->next)
+        t->next->pprev = &t->next;
+    *head = t;
+    t->pprev = head;
+    t->level = level;
+    t->slot = slot;
+    occupied[level] |= 1ull << slot;
+}
+
+static void Unlink(Timer_t *t) {
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->pprev = NULL;
+    if (wheel[t->level][t->slot] == NULL)
+        occupied[t->level] &= ~(1ull << t->slot);
+}
+
+// File a timer by how far its expiry is from the wheel position
+static void Insert(Timer_t *t) {
+    Time_t delta = t->expires - wheelTime;
+    if ((int)delta < 0) {
+        t->expires = wheelTime;  // Overdue, expire on the next step
+        delta = 0;
+    }
+
+    Time_t at = t->expires;
+    if (delta >= WHEEL_SPAN) {
+        at = wheelTime + WHEEL_SPAN - 1;  // Park in the last slot, re-filed later
+        delta = WHEEL_SPAN - 1;
+    }
+
+    int level = 0;
+    while (level < LEVELS - 1 && delta >= (1u << SHIFT(level + 1)))
+        level++;
+    Link(t, level, (at >> SHIFT(level)) & SLOT_MASK);
+}
+
+// Re-file all timers of a higher-level slot
+static void Cascade(int level, int slot) {
+    Timer_t *t = wheel[level][slot];
+    wheel[level][slot] = NULL;
+    occupied[level] &= ~(1ull << slot);
+
+    while (t != NULL) {
+        Timer_t *next = t->next;
+        Insert(t);
+        t = next;
+    }
+}
+
+// --------------------------------------------------------
+// Finding work
+// --------------------------------------------------------
+
+// Slots from 'from' to the next non-empty one, wrapping around
+static unsigned NextSlot(int level, unsigned from) {
+    uint64_t bits = occupied[level];
+    if (from)
+        bits = (bits >> from) | (bits << (SLOTS - from));
+    return __builtin_ctzll(bits);
+}
+
+static bool WheelEmpty(void) {
+    return !(occupied[0] | occupied[1] | occupied[2]);
+}
+
+// Earliest millisecond with timers due or a slot to cascade,
+// the wheel must not be empty
+static Time_t NextWork(void) {
+    Time_t next = wheelTime + WHEEL_SPAN;
+
+    for (int l = 0; l < LEVELS; l++) {
+        if (!occupied[l])
+            continue;
+        // Index of the next boundary of this level not yet processed
+        Time_t index = (wheelTime + (1u << SHIFT(l)) - 1) >> SHIFT(l);
+        Time_t at = (index + NextSlot(l, index & SLOT_MASK)) << SHIFT(l);
+        if (at - wheelTime < next - wheelTime)
+            next = at;
+    }
+    return next;
+}
+
+// --------------------------------------------------------
+// Timer control
+// --------------------------------------------------------
+void TimerStart(Timer_t *t, Time_t delay, Time_t period) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (t->pprev)
+        Unlink(t);
+    t->expires = TimeNow() + delay;
+    t->period = period;
+    t->active = true;
+    t->fired = false;
+    Insert(t);
+    WakeAt(t->expires);
+
+    __set_PRIMASK(primask);
+}
+
+void TimerStop(Timer_t *t) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (t->pprev)
+        Unlink(t);
+    t->active = false;
+
+    __set_PRIMASK(primask);
+}
+
+bool TimerFired(Timer_t *t) {
+    if (!t->fired)
+        return false;
+    t->fired = false;
+    return true;
+}
+
+bool TimerActive(const Timer_t *t) {
+    return t->active;
+}
+
+// --------------------------------------------------------
+// Expiry
+// --------------------------------------------------------
+void TimerService(void) {
+    Time_t now = TimeNow();
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    for (;;) {
+        // Jump straight to the next millisecond that has work
+        Time_t t = WheelEmpty() ? now + 1 : NextWork();
+        if ((int)(t - now) > 0) {
+            wheelTime = now + 1;
+            break;
+        }
+        wheelTime = t;
+
+        // Bring down timers whose range starts here, coarsest first
+        for (int l = LEVELS - 1; l > 0; l--)
+            if ((t & ((1u << SHIFT(l)) - 1)) == 0)
+                Cascade(l, (t >> SHIFT(l)) & SLOT_MASK);
+
+        // Expire the slot. Its timers are taken off it first, as ones
+        // re-filed from here on (a period of 64 ms lands in the same
+        // slot) are due a whole turn later. The detached list keeps its
+        // links, so callbacks can still stop or restart timers on it.
+        wheelTime = t + 1;
+        Timer_t *due = wheel[0][t & SLOT_MASK];
+        wheel[0][t & SLOT_MASK] = NULL;
+        occupied[0] &= ~(1ull << (t & SLOT_MASK));
+        if (due)
+            due->pprev = &due;
+        Timer_t *tm;
+        while ((tm = due) != NULL) {
+            Unlink(tm);
+            tm->active = false;
+            if (tm->period) {
+                tm->expires += tm->period;
+                tm->active = true;
+                Insert(tm);
+            }
+            tm->fired = true;
+
+            if (tm->callback) {
+                __set_PRIMASK(primask);
+                tm->callback(tm);
+                __disable_irq();
+            }
+        }
+    }
+
+    __set_PRIMASK(primask);
+    WakeAt(TimerNextExpiry());
+}
+
+Time_t TimerNextExpiry(void) {
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    Time_t next = WheelEmpty() ? TimeNow() + MAX_SLEEP : NextWork();
+    __set_PRIMASK(primask);
+    return next;
+}
@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# Decode LOG() records from an ITM trace capture
+#
+#   Tools/logdecode.py Debug/CEG3136_Lab2.elf swo.bin
+#
+# The capture is the raw ITM packet stream, as written by e.g.
+# OpenOCD "tpiu config internal swo.bin uart off <core clock>".
+# Port 0 (printf) text is passed through; records on the log port are
+# formatted with the strings of the "logstr" section of the .elf.
+# Reads the capture from stdin when no file is given.
+
+import re
+import struct
+import sys
+
+LOG_PORT = 1        # Inc/log.h
+LOG_MAX_ARGS = 3
+
+# --------------------------------------------------------
+# Format strings
+# --------------------------------------------------------
+def logstr_section(path):
+    """Returns (address, bytes) of the logstr section of an ELF32 file."""
+    with open(path, 'rb') as f:
+        elf = f.read()
+    if elf[:4] != b'\x7fELF' or elf[4] != 1 or elf[5] != 1:
+        sys.exit(f'{path}: not a little-endian ELF32 file')
+    shoff, = struct.unpack_from('<I', elf, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from('<HHH', elf, 0x2E)
+
+    def header(i):
+        # name, type, flags, addr, offset, size
+        return struct.unpack_from('<IIIIII', elf, shoff + i * shentsize)
+
+    names = header(shstrndx)
+    for i in range(shnum):
+        name, _, _, addr, offset, size = header(i)
+        start = names[4] + name
+        if elf[start:elf.index(b'\0', start)] == b'logstr':
+            return addr, elf[offset:offset + size]
+    sys.exit(f'{path}: no logstr section, was it linked with LOG() in use?')
+
+
+# %d %u %x %c with flags, width and C length modifiers
+CONVERSION = re.compile(r'%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|j|t)?([diuxXoc%])')
+
+def render(fmt, args):
+    args = list(args)
+
+    def conv(m):
+        flags, kind = m.groups()
+        if kind == '%':
+            return '%'
+        v = args.pop(0) if args else 0
+        if kind in 'di':
+            v = v - (1 << 32) if v & 0x80000000 else v
+            kind = 'd'
+        elif kind == 'u':
+            kind = 'd'
+        return ('%' + flags + kind) % v
+
+    return CONVERSION.sub(conv, fmt)
+
+
+# --------------------------------------------------------
+# ITM packets
+# --------------------------------------------------------
+def itm_packets(data):
+    """Yields (port, payload) for each software source packet."""
+    i = 0
+    while i < len(data):
+        h = data[i]
+        i += 1
+        if h == 0x00:
+            while i < len(data) and data[i] == 0x00:
+                i += 1
+            i += 1                          # Synchronization, ends in 0x80
+            continue
+        if h == 0x70:
+            continue                        # Overflow
+        size = (1, 2, 4)[(h & 3) - 1] if h & 3 else 0
+        if size == 0:
+            while h & 0x80 and i < len(data):   # Timestamp, extension
+                h = data[i]
+                i += 1
+            continue
+        payload = data[i:i + size]
+        i += size
+        if not h & 4:                       # Hardware source packets skipped
+            yield h >> 3, int.from_bytes(payload, 'little')
+
+
+def decode(elf, capture, out):
+    base, strings = logstr_section(elf)
+    words = []
+    for port, value in itm_packets(capture):
+        if port == 0:
+            out.write(chr(value & 0xFF))
+        elif port == LOG_PORT:
+            words.append(value)
+            if len(words) <= words[0] & LOG_MAX_ARGS:
+                continue                    # Arguments still to come
+            at = (words[0] & ~LOG_MAX_ARGS) - base
+            if 0 <= at < len(strings):
+                fmt = strings[at:strings.index(b'\0', at)].decode(errors='replace')
+                out.write(render(fmt, words[1:]) + '\n')
+            else:
+                out.write(f'<unknown record {words[0]:08X}>\n')
+            words = []
+
+
+if __name__ == '__main__':
+    if len(sys.argv) not in (2, 3):
+        sys.exit('usage: logdecode.py <elf> [capture]')
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], 'rb') as f:
+            capture = f.read()
+    else:
+        capture = sys.stdin.buffer.read()
+    decode(sys.argv[1], capture, sys.stdout)